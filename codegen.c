@@ -15,15 +15,37 @@
 #endif
 
 static FILE *output_file;
+// The text of functions goes to their IR instead of output_file.
+static struct IRFunc *current_ir;
 
 __attribute__((format(printf, 1, 2)))
 static void println(const char *fmt, ...)
 {
 	va_list ap;
 	va_start(ap, fmt);
-	vfprintf(output_file, fmt, ap);
+
+	if (!current_ir) {
+		vfprintf(output_file, fmt, ap);
+		va_end(ap);
+		fprintf(output_file, "\n");
+		return;
+	}
+
+	char buf[256];
+	va_list ap2;
+	va_copy(ap2, ap);
+	int len = vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
-	fprintf(output_file, "\n");
+
+	if (len < (int)sizeof(buf)) {
+		ir_append(current_ir, buf);
+	} else {
+		char *p = malloc(len + 1);
+		vsnprintf(p, len + 1, fmt, ap2);
+		ir_append(current_ir, p);
+		free(p);
+	}
+	va_end(ap2);
 }
 
 static int count(void)
@@ -100,8 +122,216 @@ static void __pop(const char *reg)
 	depth--;
 }
 
+// Register allocator for the temporaries of gen_expr().
+//
+// gen_expr() evaluates one operand, keeps it as a temporary while the
+// other operand is evaluated, and consumes it right after. The live
+// intervals of the temporaries are therefore properly nested, and a
+// linear scan over them in evaluation order only has to track the
+// active intervals, which form a stack. Each new interval takes the
+// first free register. An interval that may contain a function call
+// is restricted to the callee-saved registers. If no register is left,
+// the temporary is spilled to the machine stack and accounted for in
+// `depth` like any other push.
+static const char * const tmpreg[] = {
+	// caller-saved, not used as scratch registers by codegen
+	"t3", "t4", "t5", "t6",
+	// callee-saved, s0 is the frame pointer
+	"s1", "s2", "s3", "s4", "s5", "s6",
+	"s7", "s8", "s9", "s10", "s11",
+};
+
+#define NR_TMP_REGS ARRAY_SIZE(tmpreg)
+#define FIRST_CALLEE_SAVED 4
+#define MAX_TMP_DEPTH 1024
+
+// index into tmpreg[] for each active temporary, -1 if spilled
+static int tmp_stack[MAX_TMP_DEPTH];
+// `depth` right after a spilled temporary was pushed
+static int tmp_spill_depth[MAX_TMP_DEPTH];
+static int tmp_depth;
+static bool tmp_busy[NR_TMP_REGS];
+// callee-saved registers the current function has to preserve
+static bool tmp_saved[NR_TMP_REGS];
+// ND_LHS_VAL loads from `lhs_offset` bytes past the address in the
+// temporary at lhs_tmp, or past fp if lhs_tmp is -1.
+static int lhs_tmp = -1;
+static int lhs_offset;
+
+// The register a promoted variable is kept in.
+static const char *var_reg(struct Obj *var)
+{
+	return tmpreg[var->reg - 1];
+}
+
+static bool is_float_reg(const char *reg)
+{
+	return reg[0] == 'f' && strcmp(reg, "fp");
+}
+
+static void push_tmp(const char *reg, bool across_call)
+{
+	if (tmp_depth == MAX_TMP_DEPTH)
+		error("expression is too complex");
+
+	size_t i = across_call ? FIRST_CALLEE_SAVED : 0;
+	while (i < NR_TMP_REGS && tmp_busy[i])
+		i++;
+
+	if (i == NR_TMP_REGS) {
+		push(reg);
+		tmp_spill_depth[tmp_depth] = depth;
+		tmp_stack[tmp_depth++] = -1;
+		return;
+	}
+
+	tmp_busy[i] = true;
+	if (i >= FIRST_CALLEE_SAVED)
+		tmp_saved[i] = true;
+	tmp_stack[tmp_depth++] = i;
+
+	// floating-point values are kept as raw bits
+	if (is_float_reg(reg))
+		println("\tfmv.x.d %s, %s", tmpreg[i], reg);
+	else
+		println("\tmv %s, %s", tmpreg[i], reg);
+}
+
+// Copy the temporary at `pos` of the stack into reg without
+// releasing it.
+static void get_tmp(int pos, const char *reg)
+{
+	assert(pos >= 0 && pos < tmp_depth);
+
+	int i = tmp_stack[pos];
+	if (i < 0)
+		println("\t%sld %s, %d(sp)", is_float_reg(reg) ? "f" : "", reg,
+			(depth - tmp_spill_depth[pos]) * (int)sizeof(long));
+	else if (is_float_reg(reg))
+		println("\tfmv.d.x %s, %s", reg, tmpreg[i]);
+	else
+		println("\tmv %s, %s", reg, tmpreg[i]);
+}
+
+// Copy the top temporary into reg without releasing it.
+static void peek_tmp(const char *reg)
+{
+	assert(tmp_depth > 0);
+	get_tmp(tmp_depth - 1, reg);
+}
+
+static void pop_tmp(const char *reg)
+{
+	assert(tmp_depth > 0);
+
+	int i = tmp_stack[tmp_depth - 1];
+	if (i < 0) {
+		pop(reg);
+	} else {
+		peek_tmp(reg);
+		tmp_busy[i] = false;
+	}
+	tmp_depth--;
+}
+
+// Struct copies of up to this many loads and stores are inlined,
+// larger ones call memcpy().
+#define MAX_INLINE_COPY 16
+
+static const char *load_insn[] = {
+	[1] = "lb", [2] = "lh", [4] = "lw", [8] = "ld",
+};
+
+static const char *store_insn[] = {
+	[1] = "sb", [2] = "sh", [4] = "sw", [8] = "sd",
+};
+
+// The widest access at `off` an `align`ed address allows, copying
+// at most `left` bytes.
+static int copy_width(int align, int off, int left)
+{
+	for (int w = sizeof(long); w > 1; w /= 2)
+		if (w <= align && off % w == 0 && w <= left)
+			return w;
+	return 1;
+}
+
+static bool copy_by_memcpy(struct Type *ty)
+{
+	int n = 0;
+
+	for (int i = 0; i < ty->size; n++)
+		i += copy_width(ty->align, i, ty->size - i);
+	return n > MAX_INLINE_COPY;
+}
+
+// Zero-clears of up to this many stores are inlined, up to
+// MEMZERO_LOOP_MAX bytes a loop clears the doublewords, larger ones
+// call memset().
+#define MAX_INLINE_ZERO 16
+#define MEMZERO_LOOP_MAX 256
+
+static bool zero_by_memset(int size)
+{
+	return size > MEMZERO_LOOP_MAX;
+}
+
+// Returns true if evaluating a given node may clobber the caller-saved
+// registers. Besides function calls, long double arithmetic is done by
+// libgcc routines, and TLS variables are resolved by __tls_get_addr()
+// with -fpic.
+static bool may_call(struct Node *node)
+{
+	if (!node)
+		return false;
+
+	switch (node->kind) {
+	case ND_FUNCALL:
+		if (node->lhs->kind != ND_VAR ||
+		    strcmp(node->lhs->var->name, "alloca"))
+			return true;
+		break;
+	case ND_ASM:
+		return true;
+	case ND_ASSIGN:
+		if (is_struct_union(node->ty) && copy_by_memcpy(node->ty))
+			return true;
+		break;
+	case ND_MEMZERO:
+		return zero_by_memset(node->end - node->begin);
+	case ND_VAR:
+		if (node->var->is_tls && get_opt_fpic())
+			return true;
+		break;
+	default:
+		break;
+	}
+
+	if (node->ty && node->ty->kind == TY_LDOUBLE)
+		return true;
+
+	if (may_call(node->lhs) || may_call(node->rhs) ||
+	    may_call(node->cond) || may_call(node->then) ||
+	    may_call(node->els) || may_call(node->init) ||
+	    may_call(node->inc) || may_call(node->cas_addr) ||
+	    may_call(node->cas_old) || may_call(node->cas_new))
+		return true;
+
+	for (struct Node *n = node->body; n; n = n->next)
+		if (may_call(n))
+			return true;
+
+	for (struct Node *n = node->args; n; n = n->next)
+		if (may_call(n))
+			return true;
+
+	return false;
+}
+
 // let the (fs0-fs11) registers be the stack for long double
 static int ld_sp;
+// fs registers the current function has used, and has to preserve
+static int ld_sp_max;
 
 #define push_ld() do {				\
 	__push_ld();				\
@@ -120,6 +350,7 @@ static void __push_ld(void)
 	println("\tfmv.d.x fs%d, a0", ld_sp);
 	println("\tfmv.d.x fs%d, a1", ld_sp + 1);
 	ld_sp += 2;
+	ld_sp_max = MAX(ld_sp_max, ld_sp);
 
 	if (ld_sp >= 12)
 		error("ld_sp can't be larger than 12");
@@ -135,35 +366,36 @@ static void __pop_ld(void)
 	ld_sp -= 2;
 }
 
-#define load_ld() do {				\
-	__load_ld();				\
+#define load_ld(base, offset) do {		\
+	__load_ld(base, offset);		\
 	ldsp_debug("load_ld ld_sp %d at %s:%d\n",	\
 		ld_sp, __FILE__, __LINE__);	\
 } while (0)
 
-#define store_ld(x) do {			\
-	__store_ld(x);				\
+#define store_ld(base, offset) do {		\
+	__store_ld(base, offset);		\
 	ldsp_debug("store_ld ld_sp %d at %s:%d\n",	\
 		ld_sp, __FILE__, __LINE__);	\
 } while (0)
 
-static void __load_ld(void)
+static void __load_ld(const char *base, int offset)
 {
-	println("\tfld fs%d, 0(a0)", ld_sp);
-	println("\tfld fs%d, 8(a0)", ld_sp + 1);
+	println("\tfld fs%d, %d(%s)", ld_sp, offset, base);
+	println("\tfld fs%d, %d(%s)", ld_sp + 1, offset + 8, base);
 	ld_sp += 2;
+	ld_sp_max = MAX(ld_sp_max, ld_sp);
 
 	if (ld_sp >= 12)
 		error("ld_sp can't be larger than 12");
 }
 
-static void __store_ld(void)
+static void __store_ld(const char *base, int offset)
 {
 	if (ld_sp < 2)
 		error("ld_sp can't be less than 2");
 
-	println("\tfsd fs%d, 8(a1)", ld_sp - 1);
-	println("\tfsd fs%d, 0(a1)", ld_sp - 2);
+	println("\tfsd fs%d, %d(%s)", ld_sp - 1, offset + 8, base);
+	println("\tfsd fs%d, %d(%s)", ld_sp - 2, offset, base);
 	ld_sp -= 2;
 }
 
@@ -180,8 +412,16 @@ static bool beyond_instruction_offset(int offset)
 	return offset > 2047 || offset < -2048;
 }
 
+// Whether `val` fits the immediate of an I-type instruction.
+static bool is_imm12(int64_t val)
+{
+	return val >= -2048 && val <= 2047;
+}
+
 static void gen_expr(struct Node *node);
 static void gen_stmt(struct Node *node);
+static bool is_int_const(struct Node *node, int64_t *val);
+static const char *gen_addr_disp(struct Node *node, int *offset);
 
 __attribute__((unused))
 static void absolute_addressing(const char *symbol)
@@ -194,13 +434,8 @@ static void absolute_addressing(const char *symbol)
 
 static void relative_addressing(const char *symbol)
 {
-	int c = count();
-	println(".L.pcrel%d:", c);
-
-	// HI20
-	println("\tauipc a0, %%pcrel_hi(%s)", symbol);
-	// LO12
-	println("\taddi a0, a0, %%pcrel_lo(.L.pcrel%d)", c);
+	// auipc + addi, the assembler makes up the label for %pcrel_lo
+	println("\tlla a0, %s", symbol);
 }
 
 static void GOT_relative_addressing(const char *symbol)
@@ -230,6 +465,28 @@ static void TLS_relative_addressing(const char *symbol)
 	println("\tcall __tls_get_addr@plt");
 }
 
+// Whether loads and stores can take `offset` as their displacement,
+// leaving room for the second doubleword of a long double.
+static bool fits_disp(int64_t offset)
+{
+	return is_imm12(offset) && is_imm12(offset + 8);
+}
+
+// Compute the address `offset` bytes past where base is pointing to
+// into a0.
+static void add_disp(const char *base, int64_t offset)
+{
+	if (!offset && !strcmp(base, "a0"))
+		return;
+
+	if (is_imm12(offset)) {
+		println("\tadd a0, %s, %ld", base, offset);
+	} else {
+		println("\tli t0, %ld", offset);
+		println("\tadd a0, %s, t0", base);
+	}
+}
+
 // Compute the absolute address of a given node.
 // It's an error if a given node does not reside in memory.
 static void gen_addr(struct Node *node)
@@ -246,6 +503,10 @@ static void gen_addr(struct Node *node)
 
 		// local variable
 		if (node->var->is_local) {
+			// promoted variables have no address
+			if (node->var->reg)
+				unreachable();
+
 			if (beyond_instruction_offset(node->var->offset)) {
 				println("\tli t0, %d", node->var->offset);
 				println("\tadd a0, fp, t0");
@@ -262,9 +523,13 @@ static void gen_addr(struct Node *node)
 				return;
 			}
 
-			// Function or global variable from GOT table
-			GOT_relative_addressing(node->var->name);
-			return;
+			// A symbol that isn't static may be preempted by a
+			// definition in another module, take its address
+			// from the GOT.
+			if (!node->var->is_static) {
+				GOT_relative_addressing(node->var->name);
+				return;
+			}
 		}
 
 		// Thread-local variable
@@ -276,51 +541,19 @@ static void gen_addr(struct Node *node)
 			return;
 		}
 
-		// Here, we generate an absolute address of a function or a global
-		// variable. Even though they exist at a certain address at runtime,
-		// their addresses are not known at link-time for the following
-		// two reasons.
+		// Here, we generate the address of a function or a global
+		// variable. Executables are loaded to memory as a whole, but
+		// it is not known what address they are loaded to. The
+		// distance from the code to the symbol is known at link-time,
+		// though, so we use pc-relative addressing.
 		//
-		//  - Address randomization: Executables are loaded to memory as a
-		//    whole but it is not known what address they are loaded to.
-		//    Therefore, at link-time, relative address in the same
-		//    executable (i.e. the distance between two functions in the
-		//    same executable) is known, but the absolute address is not
-		//    known.
-		//
-		//  - Dynamic linking: Dynamic shared objects (DSOs) or .so files
-		//    are loaded to memory alongside an executable at runtime and
-		//    linked by the runtime loader in memory. We know nothing
-		//    about addresses of global stuff that may be defined by DSOs
-		//    until the runtime relocation is complete.
-		//
-		// In order to deal with the former case, we use relative
-		// addressing, denoted by `jal symbol` (here is `jalr a0`).
-		//
-		// For the latter, we obtain an address of a stuff that may be in
-		// a shared object file from the Global Offset Table using
-		// `got_pcrel_hi(symbol)` notation.
-
-		// function
-		if (node->ty->kind == TY_FUNC) {
-			if (node->var->is_definition) {
-				// relative address
-				debug("function call by relative address '%s'",
-					node->var->name);
-				relative_addressing(node->var->name);
-
-			} else {
-				// dynamic linking, from .so files
-				debug("function call from DSOs '%s'",
-					node->var->name);
-				GOT_relative_addressing(node->var->name);
-			}
-			break;
-		}
-
-		// global variable
-		debug("global variable '%s'", node->var->name);
-		GOT_relative_addressing(node->var->name);
+		// Without -fpic we link an executable, where the linker
+		// resolves the symbols that shared objects define to copies
+		// of the data and PLT entries of the functions in the
+		// executable itself, so pc-relative addressing works for
+		// every symbol. With -fpic it only does for static ones.
+		debug("pc-relative address of '%s'", node->var->name);
+		relative_addressing(node->var->name);
 		break;
 
 	case ND_DEREF:
@@ -332,15 +565,12 @@ static void gen_addr(struct Node *node)
 		gen_addr(node->rhs);
 		break;
 
-	case ND_MEMBER:
-		gen_addr(node->lhs);
-		if (beyond_instruction_offset(node->member->offset)) {
-			println("\tli t0, %d", node->member->offset);
-			println("\tadd a0, a0, t0");
-		} else {
-			println("\tadd a0, a0, %d", node->member->offset);
-		}
+	case ND_MEMBER: {
+		int offset;
+		const char *base = gen_addr_disp(node, &offset);
+		add_disp(base, offset);
 		break;
+	}
 
 	case ND_FUNCALL:
 		if (node->ret_buffer)
@@ -367,10 +597,82 @@ static void gen_addr(struct Node *node)
 	}
 }
 
+// Compute the address of a given node as a register plus a constant
+// `offset`, which loads and stores encode in their 12-bit displacement.
+// The register is fp for local variables and a0 otherwise. Member
+// offsets and constant indices are folded into the offset as long as
+// it fits, and added with li and add otherwise.
+static const char *gen_addr_disp(struct Node *node, int *offset)
+{
+	const char *base;
+	int64_t val;
+
+	switch (node->kind) {
+	case ND_VAR:
+		if (node->var->is_local && node->var->ty->kind != TY_VLA &&
+		    !node->var->reg && fits_disp(node->var->offset)) {
+			*offset = node->var->offset;
+			return "fp";
+		}
+		break;
+
+	case ND_MEMBER:
+		base = gen_addr_disp(node->lhs, offset);
+		val = (int64_t)*offset + node->member->offset;
+		if (fits_disp(val)) {
+			*offset = val;
+			return base;
+		}
+		add_disp(base, val);
+		*offset = 0;
+		return "a0";
+
+	case ND_DEREF: {
+		// ptr + C or ptr - C, C being scaled to bytes already
+		struct Node *addr = node->lhs;
+		if ((addr->kind != ND_ADD && addr->kind != ND_SUB) ||
+		    !addr->ty->base || !is_int_const(addr->rhs, &val))
+			break;
+		if (addr->kind == ND_SUB)
+			val = -val;
+
+		// An array evaluates to its address.
+		struct Node *ptr = addr->lhs;
+		if (ptr->kind == ND_CAST && ptr->lhs->ty->kind == TY_ARRAY)
+			ptr = ptr->lhs;
+		if (ptr->ty->kind == TY_ARRAY &&
+		    (ptr->kind == ND_VAR || ptr->kind == ND_MEMBER ||
+		     ptr->kind == ND_DEREF)) {
+			base = gen_addr_disp(ptr, offset);
+		} else {
+			gen_expr(ptr);
+			base = "a0";
+			*offset = 0;
+		}
+
+		if (fits_disp(*offset + val)) {
+			*offset += val;
+			return base;
+		}
+		add_disp(base, *offset);
+		add_disp("a0", val);
+		*offset = 0;
+		return "a0";
+	}
+
+	default:
+		break;
+	}
+
+	gen_addr(node);
+	*offset = 0;
+	return "a0";
+}
+
 static struct Obj *current_fn;
 
-// Load a value from where a0 is pointing to.
-static void load(struct Type *ty)
+// Load a value from `offset` bytes past where base is pointing to.
+static void __load(struct Type *ty, const char *base, int offset)
 {
 	// If it is an array, do not attempt to load a value
 	// to the register because in general we can't load
@@ -386,16 +688,17 @@ static void load(struct Type *ty)
 	case TY_UNION:
 	case TY_FUNC:
 	case TY_VLA:
+		add_disp(base, offset);
 		return;
 
 	case TY_FLOAT:
-		println("\tflw fa0, (a0)");
+		println("\tflw fa0, %d(%s)", offset, base);
 		return;
 	case TY_DOUBLE:
-		println("\tfld fa0, (a0)");
+		println("\tfld fa0, %d(%s)", offset, base);
 		return;
 	case TY_LDOUBLE:
-		load_ld();
+		load_ld(base, offset);
 		return;
 
 	default:
@@ -410,50 +713,125 @@ static void load(struct Type *ty)
 	// register for char, short and int may contain garbage. When we load
 	// a long value to a register, it simply occupies the entire register.
 	if (ty->size == sizeof(char))
-		println("\tlb%s a0, (a0)", suffix);
+		println("\tlb%s a0, %d(%s)", suffix, offset, base);
 	else if (ty->size == sizeof(short))
-		println("\tlh%s a0, (a0)", suffix);
+		println("\tlh%s a0, %d(%s)", suffix, offset, base);
 	else if (ty->size == sizeof(int))
-		println("\tlw%s a0, (a0)", suffix);
+		println("\tlw%s a0, %d(%s)", suffix, offset, base);
 	else
-		println("\tld a0, (a0)");
+		println("\tld a0, %d(%s)", offset, base);
 }
 
-// Store a0 to an address that the stack top is pointing to.
-static void store(struct Type *ty)
+static void load_from(struct Type *ty, const char *base, int offset)
 {
-	pop("a1");
+	struct Insn *last = current_ir->tail;
 
-	switch (ty->kind) {
-	case TY_STRUCT:
-	case TY_UNION:
-		for (int i = 0; i < ty->size; i++) {
-			// load & store byte by byte
-			if (beyond_instruction_offset(i)) {
-				println("\tli t0, %d", i);
-				println("\tadd t0, a0, t0");
-				println("\tlb t1, (t0)");
-
-				println("\tli t0, %d", i);
-				println("\tadd t0, a1, t0");
-				println("\tsb t1, (t0)");
-			} else {
-				println("\tlb t0, %d(a0)", i);
-				println("\tsb t0, %d(a1)", i);
-			}
-		}
+	__load(ty, base, offset);
+
+	// A volatile object has to be read each time.
+	if (ty->is_volatile)
+		for (struct Insn *insn = last ? last->next : current_ir->head;
+		     insn; insn = insn->next)
+			insn->is_volatile = true;
+}
+
+// Load a value from where a0 is pointing to.
+static void load(struct Type *ty)
+{
+	load_from(ty, "a0", 0);
+}
+
+// Clear the bytes [offset, offset + size) from fp with the widest
+// stores they are aligned for, fp being 16-byte aligned.
+static void zero_stores(const char *base, int offset, int start, int size)
+{
+	for (int i = 0, w; i < size; i += w) {
+		w = copy_width(sizeof(long), start + i, size - i);
+		println("\t%s zero, %d(%s)", store_insn[w], offset + i, base);
+	}
+}
+
+static void memzero(int offset, int size)
+{
+	if (zero_by_memset(size)) {
+		println("\tli a0, %d", offset);
+		println("\tadd a0, fp, a0");
+		println("\tli a1, 0");
+		println("\tli a2, %d", size);
+		println("\tcall memset");
+		return;
+	}
+
+	const char *base = "fp";
+	int start = offset;
+
+	if (beyond_instruction_offset(offset) ||
+	    beyond_instruction_offset(offset + size)) {
+		println("\tli t0, %d", offset);
+		println("\tadd t0, fp, t0");
+		base = "t0";
+		offset = 0;
+	}
+
+	int n = 0;
+	for (int i = 0; i < size; n++)
+		i += copy_width(sizeof(long), start + i, size - i);
+
+	if (n <= MAX_INLINE_ZERO) {
+		zero_stores(base, offset, start, size);
+		return;
+	}
+
+	// the unaligned head and tail around the doublewords
+	int head = MIN((int)(sizeof(long) - (start & 7)) & 7, size);
+	int words = (size - head) / sizeof(long) * sizeof(long);
+
+	zero_stores(base, offset, start, head);
+	println("\taddi t1, %s, %d", base, offset + head);
+	println("\taddi t2, t1, %d", words);
+	println("1:");
+	println("\tsd zero, 0(t1)");
+	println("\taddi t1, t1, 8");
+	println("\tbne t1, t2, 1b");
+	zero_stores(base, offset + head + words, start + head + words,
+		    size - head - words);
+}
+
+// Copy a struct from where a0 is pointing to where a1 is pointing
+// to, and leave the destination in a0.
+static void copy_struct(struct Type *ty)
+{
+	if (copy_by_memcpy(ty)) {
+		println("\tmv t0, a0");
+		println("\tmv a0, a1");
+		println("\tmv a1, t0");
+		println("\tli a2, %d", ty->size);
+		println("\tcall memcpy");
 		return;
+	}
+
+	for (int i = 0, w; i < ty->size; i += w) {
+		w = copy_width(ty->align, i, ty->size - i);
+		println("\t%s t0, %d(a0)", load_insn[w], i);
+		println("\t%s t0, %d(a1)", store_insn[w], i);
+	}
+	println("\tmv a0, a1");
+}
 
+// Store a0 to `offset` bytes past where base is pointing to.
+static void store_to(struct Type *ty, const char *base, int offset)
+{
+	switch (ty->kind) {
 	case TY_FLOAT:
-		println("\tfsw fa0, (a1)");
+		println("\tfsw fa0, %d(%s)", offset, base);
 		return;
 
 	case TY_DOUBLE:
-		println("\tfsd fa0, (a1)");
+		println("\tfsd fa0, %d(%s)", offset, base);
 		return;
 
 	case TY_LDOUBLE:
-		store_ld();
+		store_ld(base, offset);
 		return;
 
 	default:
@@ -461,13 +839,106 @@ static void store(struct Type *ty)
 	}
 
 	if (ty->size == sizeof(char))
-		println("\tsb a0, (a1)");
+		println("\tsb a0, %d(%s)", offset, base);
 	else if (ty->size == sizeof(short))
-		println("\tsh a0, (a1)");
+		println("\tsh a0, %d(%s)", offset, base);
 	else if (ty->size == sizeof(int))
-		println("\tsw a0, (a1)");
+		println("\tsw a0, %d(%s)", offset, base);
+	else
+		println("\tsd a0, %d(%s)", offset, base);
+}
+
+// Store a0 to an address that the stack top is pointing to.
+static void store(struct Type *ty)
+{
+	pop_tmp("a1");
+
+	if (is_struct_union(ty))
+		copy_struct(ty);
+	else
+		store_to(ty, "a1", 0);
+}
+
+static bool is_bitfield(struct Node *node)
+{
+	return node->kind == ND_MEMBER && node->member->is_bitfield;
+}
+
+// Extract a bitfield member from its storage unit in a0.
+static void extract_bitfield(struct Member *mem)
+{
+	// Clear unused high bits of field member variables
+	println("\tslli a0, a0, %d", 64 - mem->bit_width - mem->bit_offset);
+	// Clear unused low bits of field member variables
+	if (mem->ty->is_unsigned)
+		println("\tsrli a0, a0, %d", 64 - mem->bit_width);
+	else
+		println("\tsrai a0, a0, %d", 64 - mem->bit_width);
+}
+
+// Store a0 to a bitfield member whose storage unit the stack top is
+// pointing to, leaving a0 as it was.
+static void store_bitfield(struct Member *mem, struct Type *ty)
+{
+	// save value of the bitfield
+	println("\tmv t2, a0");
+
+	// We need to read the current value from memory
+	// and merge it with a new value.
+	debug("merge new value into bit_field");
+
+	println("\tmv t0, a0");
+	println("\tli t1, %ld", (1L << mem->bit_width) - 1);
+	println("\tand t0, t0, t1");
+
+	println("\tslli t0, t0, %d", mem->bit_offset);
+
+	// Load the address where the bit field value is saved in.
+	// ty is the member's type, volatile if the struct is.
+	peek_tmp("a0");
+	load(ty);
+
+	long mask = ((1L << mem->bit_width) - 1) << mem->bit_offset;
+	println("\tli t1, %ld", ~mask);
+
+	println("\tand a0, a0, t1");
+	println("\tor a0, a0, t0");
+	store(ty);
+
+	debug("merge new value into bit_field end");
+
+	// restore value of the bitfield
+	println("\tmv a0, t2");
+}
+
+// Load a variable kept in a register. Floating-point values are kept
+// as raw bits in the integer register.
+static void load_reg_var(struct Obj *var)
+{
+	if (is_float(var->ty))
+		println("\tfmv.d.x fa0, %s", var_reg(var));
 	else
-		println("\tsd a0, (a1)");
+		println("\tmv a0, %s", var_reg(var));
+}
+
+// Store src to a variable kept in a register. The value is extended
+// the same way load() would extend it after a round trip to memory.
+static void store_reg_var(struct Obj *var, const char *src)
+{
+	struct Type *ty = var->ty;
+	int shift = 64 - ty->size * 8;
+
+	if (is_float(ty))
+		println("\tfmv.x.d %s, %s", var_reg(var), src);
+	else if (!shift)
+		println("\tmv %s, %s", var_reg(var), src);
+	else if (ty->size == sizeof(int) && !ty->is_unsigned)
+		println("\tsext.w %s, %s", var_reg(var), src);
+	else {
+		println("\tslli %s, %s, %d", var_reg(var), src, shift);
+		println("\tsr%si %s, %s, %d", ty->is_unsigned ? "l" : "a",
+			var_reg(var), var_reg(var), shift);
+	}
 }
 
 enum {
@@ -504,7 +975,7 @@ static int getTypeId(struct Type *ty)
 // signed => shift right Arithmetic
 #define TOI8   "\tslli a0, a0, 56\n\tsrai a0, a0, 56"
 #define TOI16  "\tslli a0, a0, 48\n\tsrai a0, a0, 48"
-#define TOI32  "\tslli a0, a0, 32\n\tsrai a0, a0, 32"
+#define TOI32  "\tsext.w a0, a0"
 
 // unsigned => shift right Logical
 #define TOU8   "\tslli a0, a0, 56\n\tsrli a0, a0, 56"
@@ -639,76 +1110,611 @@ static void cmp_zero(struct Type *ty)
 	return;
 }
 
-// Structs or unions equal or smaller than 16 bytes are passed
-// using up to two registers.
-// When structs or unions larger than 16 bytes, save the struct
-// in caller's stack, and transmit the pointer to callee by one
-// register.
-static void push_struct(struct Type *ty)
+// Returns true if `node` is an integer constant, setting `*val` to
+// what gen_expr() would load. Unfolded casts of small non-negative
+// literals keep their value.
+static bool is_int_const(struct Node *node, int64_t *val)
 {
-	int i;
-	int sz = align_to(ty->size, sizeof(long));
-	int n = sz / sizeof(long);
-
-	// transmission by registers
-	if (n <= 2) {
-		while (n--) {
-			println("\tld t0, %ld(a0)", n * sizeof(long));
-			push("t0");
-		}
-		return;
+	if (node->kind == ND_CAST && node->ty->size >= 4 &&
+	    (is_integer(node->ty) || node->ty->kind == TY_PTR) &&
+	    node->lhs->kind == ND_NUM && is_integer(node->lhs->ty) &&
+	    node->lhs->val >= 0 && node->lhs->val <= INT32_MAX) {
+		*val = node->lhs->val;
+		return true;
 	}
 
-	// transmission by stack pointer
-	println("\tadd t1, t1, %d", -sz);
+	// pointer arithmetic folds to a literal of pointer type
+	if (node->kind == ND_NUM &&
+	    (is_integer(node->ty) || node->ty->kind == TY_PTR)) {
+		*val = node->val;
+		return true;
+	}
+	return false;
+}
 
-	for (i = 0; i < n; i++) {
-		// push struct content into stack
-		println("\tld t0, %ld(a0)", i * sizeof(long));
-		println("\tsd t0, %ld(t1)", i * sizeof(long));
+// floor(2^p / d) modulo 2^64 and the remainder, for d > 1.
+static uint64_t pow2_div(int p, uint64_t d, uint64_t *rem)
+{
+	uint64_t q = 0, r = 1;
+
+	for (int i = 0; i < p; i++) {
+		bool carry = r >> 63;
+		r <<= 1;
+		q <<= 1;
+		if (carry || r >= d) {
+			r -= d;
+			q |= 1;
+		}
 	}
-	depth += n;
 
-	push("t1");
+	*rem = r;
+	return q;
 }
 
-static void push_args2(struct Node *args, bool first_pass)
+// Divide, or take the remainder, by a constant with shifts, or with
+// a multiplication by its inverse scaled to a power of two, taking
+// the high bits of the product (Granlund and Montgomery, "Division by
+// invariant integers using multiplication"). a0 holds the dividend,
+// t2 keeps it around for the remainder.
+static bool gen_div_const(struct Node *node, int64_t val)
 {
-	if (!args)
-		return;
+	bool is_word = node->lhs->ty->kind != TY_LONG && !node->lhs->ty->base;
+	const char *w = is_word ? "w" : "";
+	int bits = is_word ? 32 : 64;
+	bool is_mod = node->kind == ND_MOD;
+	bool neg = false;
+	uint64_t d, rem;
+
+	if (node->ty->is_unsigned) {
+		d = is_word ? (uint32_t)val : (uint64_t)val;
+	} else {
+		int64_t v = is_word ? (int32_t)val : val;
+		neg = v < 0;
+		d = neg ? -(uint64_t)v : (uint64_t)v;
+	}
 
-	// in the right-to-left order
-	push_args2(args->next, first_pass);
+	if (!d || d >> (bits - 1))
+		return false;
 
-	if ((first_pass && !args->pass_by_stack) ||
-	   (!first_pass && args->pass_by_stack))
-		return;
+	gen_expr(node->lhs);
 
-	gen_expr(args);
+	if (d == 1) {
+		if (is_mod)
+			println("\tli a0, 0");
+		else if (neg)
+			println("\tneg%s a0, a0", w);
+		else if (is_word)
+			println("\tsext.w a0, a0");
+		return true;
+	}
 
-	switch (args->ty->kind) {
-	case TY_STRUCT:
-	case TY_UNION:
-		push_struct(args->ty);
+	int k = ctz64(d);
+
+	// powers of two
+	if (d == (uint64_t)1 << k) {
+		if (node->ty->is_unsigned) {
+			if (!is_mod) {
+				println("\tsrli%s a0, a0, %d", w, k);
+			} else if (is_imm12(d - 1)) {
+				println("\tandi a0, a0, %ld", d - 1);
+			} else {
+				println("\tslli a0, a0, %d", 64 - k);
+				println("\tsrli a0, a0, %d", 64 - k);
+			}
+			return true;
+		}
+
+		// Negative dividends are rounded toward zero by adding
+		// d - 1 before the arithmetic shift.
+		println("\tsrai%s t0, a0, %d", w, bits - 1);
+		println("\tsrli%s t0, t0, %d", w, bits - k);
+		println("\tadd%s t1, a0, t0", w);
+
+		if (!is_mod) {
+			println("\tsrai%s a0, t1, %d", w, k);
+			if (neg)
+				println("\tneg%s a0, a0", w);
+		} else {
+			if (is_imm12(-(int64_t)d)) {
+				println("\tandi t1, t1, %ld", -(int64_t)d);
+			} else {
+				println("\tsrai t1, t1, %d", k);
+				println("\tslli t1, t1, %d", k);
+			}
+			println("\tsub%s a0, a0, t1", w);
+		}
+		return true;
+	}
+
+	// the number of bits of d, ceil(log2(d))
+	int l = bit_width(d);
+
+	if (node->ty->is_unsigned && is_word) {
+		// (n << 32) * (m << (32 - l)) >> 64 >> 32
+		// with m = ceil(2^(32 + l) / d)
+		uint64_t m = pow2_div(32 + l, d, &rem) + 1;
+		println("\tmv t2, a0");
+		println("\tslli t0, a0, 32");
+		println("\tli t1, %ld", m << (32 - l));
+		println("\tmulhu a0, t0, t1");
+		println("\tsrli a0, a0, 32");
+
+	} else if (node->ty->is_unsigned) {
+		println("\tmv t2, a0");
+
+		// Look for a multiplier that fits in 64 bits, that is
+		// m = ceil(2^(64 + s) / d) with s < l, exact as long as
+		// m * d - 2^(64 + s) <= 2^s.
+		int s;
+		uint64_t m = 0;
+		for (s = 0; s < l; s++) {
+			m = pow2_div(64 + s, d, &rem) + 1;
+			if (d - rem <= (uint64_t)1 << s)
+				break;
+		}
+
+		if (s < l) {
+			println("\tli t1, %ld", m);
+			println("\tmulhu a0, a0, t1");
+			if (s)
+				println("\tsrli a0, a0, %d", s);
+		} else {
+			// m = 2^64 + m' takes 65 bits:
+			// t = n * m' >> 64, q = (t + ((n - t) >> 1)) >> (l - 1)
+			m = pow2_div(64 + l, d, &rem) + 1;
+			println("\tli t1, %ld", m);
+			println("\tmulhu t0, a0, t1");
+			println("\tsub t1, a0, t0");
+			println("\tsrli t1, t1, 1");
+			println("\tadd t0, t0, t1");
+			println("\tsrli a0, t0, %d", l - 1);
+		}
+
+	} else if (is_word) {
+		// q = (n * m >> (31 + l)) + (n < 0)
+		// with m = floor(2^(31 + l) / d) + 1, at most 2^32
+		uint64_t m = pow2_div(31 + l, d, &rem) + 1;
+		println("\tsext.w t2, a0");
+		println("\tli t1, %ld", m);
+		println("\tmul t0, t2, t1");
+		println("\tsrai t0, t0, %d", 31 + l);
+		println("\tsraiw t1, t2, 31");
+		println("\tsubw a0, t0, t1");
+
+	} else {
+		// Likewise, m = floor(2^(63 + l) / d) + 1 is 2^64 more than
+		// the negative multiplier that fits in 64 bits.
+		uint64_t m = pow2_div(63 + l, d, &rem) + 1;
+		println("\tmv t2, a0");
+		println("\tli t1, %ld", m);
+		println("\tmulh t0, a0, t1");
+		println("\tadd t0, t0, a0");
+		println("\tsrai t0, t0, %d", l - 1);
+		println("\tsrai t1, a0, 63");
+		println("\tsub a0, t0, t1");
+	}
+
+	if (is_mod) {
+		println("\tli t1, %ld", d);
+		println("\tmul%s t1, a0, t1", w);
+		println("\tsub%s a0, t2, t1", w);
+	} else if (neg) {
+		println("\tneg%s a0, a0", w);
+	}
+	return true;
+}
+
+// Generate an integer binary operation whose right operand, or left
+// one if the operation commutes, is a constant the I-type form of the
+// instruction takes. Returns false if there is no such form.
+static bool gen_imm_binary(struct Node *node)
+{
+	struct Node *lhs = node->lhs;
+	int64_t val;
+
+	if (!is_int_const(node->rhs, &val)) {
+		switch (node->kind) {
+		case ND_ADD:
+		case ND_MUL:
+		case ND_BITAND:
+		case ND_BITOR:
+		case ND_BITXOR:
+		case ND_EQ:
+		case ND_NE:
+			if (!is_int_const(node->lhs, &val))
+				return false;
+			lhs = node->rhs;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	bool is_word = node->lhs->ty->kind != TY_LONG && !node->lhs->ty->base;
+	const char *suffix = is_word ? "w" : "";
+	int bits = is_word ? 32 : 64;
+	const char *insn;
+
+	switch (node->kind) {
+	case ND_ADD:
+	case ND_SUB:
+		if (node->kind == ND_SUB && is_imm12(val))
+			val = -val;
+		if (!is_imm12(val))
+			return false;
+		gen_expr(lhs);
+		println("\taddi%s a0, a0, %ld", suffix, val);
+		return true;
+
+	case ND_MUL:
+		// pointer arithmetic scales by the element size
+		if (val <= 0 || (val & (val - 1)))
+			return false;
+		gen_expr(lhs);
+		println("\tslli%s a0, a0, %d", suffix, ctz64(val));
+		return true;
+
+	case ND_BITAND:
+	case ND_BITOR:
+	case ND_BITXOR:
+		if (!is_imm12(val))
+			return false;
+		insn = node->kind == ND_BITAND ? "andi" :
+		       node->kind == ND_BITOR ? "ori" : "xori";
+		gen_expr(lhs);
+		println("\t%s a0, a0, %ld", insn, val);
+		return true;
+
+	case ND_SHL:
+	case ND_SHR:
+		if (val < 0 || val >= bits)
+			return false;
+		insn = node->kind == ND_SHL ? "slli" :
+		       node->ty->is_unsigned ? "srli" : "srai";
+		gen_expr(lhs);
+		println("\t%s%s a0, a0, %ld", insn, suffix, val);
+		return true;
+
+	case ND_EQ:
+	case ND_NE:
+		if (!is_imm12(val))
+			return false;
+		gen_expr(lhs);
+		if (val)
+			println("\txori a0, a0, %ld", val);
+		println("\t%s a0, a0", node->kind == ND_EQ ? "seqz" : "snez");
+		return true;
+
+	case ND_DIV:
+	case ND_MOD:
+		return gen_div_const(node, val);
+
+	case ND_LE:
+		// a <= C is a < C + 1, unless C + 1 wraps around
+		if (val == (lhs->ty->is_unsigned ? -1 : INT64_MAX))
+			return false;
+		val++;
+		// fallthrough
+	case ND_LT:
+		if (!is_imm12(val))
+			return false;
+		gen_expr(lhs);
+		println("\tslti%s a0, a0, %ld",
+			lhs->ty->is_unsigned ? "u" : "", val);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Jump to `label` if `node` evaluates to `jump_if`, fall through
+// otherwise. Integer comparisons become a single branch instruction,
+// and logical operators branch straight to where their result leads
+// instead of computing it as 0 or 1.
+// Returns true if code can be generated for the expression twice.
+// Statements in it may define labels, which must be unique.
+static bool can_duplicate(struct Node *node)
+{
+	if (!node)
+		return true;
+
+	if (node->kind == ND_STMT_EXPR || node->kind == ND_ASM)
+		return false;
+
+	for (struct Node *n = node->args; n; n = n->next)
+		if (!can_duplicate(n))
+			return false;
+
+	return can_duplicate(node->lhs) && can_duplicate(node->rhs) &&
+	       can_duplicate(node->cond) && can_duplicate(node->then) &&
+	       can_duplicate(node->els) && can_duplicate(node->cas_addr) &&
+	       can_duplicate(node->cas_old) && can_duplicate(node->cas_new);
+}
+
+static void gen_branch(struct Node *node, bool jump_if, const char *label)
+{
+	int c;
+
+	switch (node->kind) {
+	case ND_NUM:
+		if (is_integer(node->ty)) {
+			if (!!node->val == jump_if)
+				println("\tj %s", label);
+			return;
+		}
+		break;
+
+	case ND_NOT:
+		gen_branch(node->lhs, !jump_if, label);
+		return;
+
+	case ND_LOGAND:
+		if (!jump_if) {
+			gen_branch(node->lhs, false, label);
+			gen_branch(node->rhs, false, label);
+			return;
+		}
+
+		c = count();
+		gen_branch(node->lhs, false, format(".L.false.%d", c));
+		gen_branch(node->rhs, true, label);
+		println(".L.false.%d:", c);
+		return;
+
+	case ND_LOGOR:
+		if (jump_if) {
+			gen_branch(node->lhs, true, label);
+			gen_branch(node->rhs, true, label);
+			return;
+		}
+
+		c = count();
+		gen_branch(node->lhs, true, format(".L.true.%d", c));
+		gen_branch(node->rhs, false, label);
+		println(".L.true.%d:", c);
+		return;
+
+	case ND_EQ:
+	case ND_NE:
+	case ND_LT:
+	case ND_LE: {
+		if (!is_integer(node->lhs->ty) && node->lhs->ty->kind != TY_PTR)
+			break;
+
+		const char *u = node->lhs->ty->is_unsigned ? "u" : "";
+		int64_t val;
+
+		if (is_int_const(node->rhs, &val)) {
+			gen_expr(node->lhs);
+
+			// compare against zero
+			if (!val && (node->kind == ND_EQ || node->kind == ND_NE ||
+				     !*u)) {
+				const char *op[][2] = {
+					[ND_EQ] = { "bnez", "beqz" },
+					[ND_NE] = { "beqz", "bnez" },
+					[ND_LT] = { "bgez", "bltz" },
+					[ND_LE] = { "bgtz", "blez" },
+				};
+				println("\t%s a0, %s", op[node->kind][jump_if], label);
+				return;
+			}
+			println("\tli a1, %ld", val);
+		} else {
+			gen_expr(node->rhs);
+			push_tmp("a0", may_call(node->lhs));
+			gen_expr(node->lhs);
+			pop_tmp("a1");
+		}
+
+		// a <= b is !(b < a)
+		switch (node->kind) {
+		case ND_EQ:
+			println("\t%s a0, a1, %s", jump_if ? "beq" : "bne", label);
+			break;
+		case ND_NE:
+			println("\t%s a0, a1, %s", jump_if ? "bne" : "beq", label);
+			break;
+		case ND_LT:
+			println("\t%s%s a0, a1, %s", jump_if ? "blt" : "bge", u, label);
+			break;
+		default:
+			println("\t%s%s a1, a0, %s", jump_if ? "bge" : "blt", u, label);
+			break;
+		}
+		return;
+	}
+
+	default:
+		break;
+	}
+
+	gen_expr(node);
+	if (is_float(node->ty)) {
+		// a0 is set if the value is zero
+		cmp_zero(node->ty);
+		println("\t%s a0, %s", jump_if ? "beqz" : "bnez", label);
+	} else {
+		println("\t%s a0, %s", jump_if ? "bnez" : "beqz", label);
+	}
+}
+
+// Structs or unions equal or smaller than 16 bytes are passed
+// using up to two registers.
+// When structs or unions larger than 16 bytes, save the struct
+// in caller's stack, and transmit the pointer to callee by one
+// register.
+static void push_struct(struct Type *ty, bool spill, bool across_call)
+{
+	int i;
+	int sz = align_to(ty->size, sizeof(long));
+	int n = sz / sizeof(long);
+
+	// transmission by registers
+	if (n <= 2) {
+		while (n--) {
+			println("\tld t0, %ld(a0)", n * sizeof(long));
+			if (spill)
+				push("t0");
+			else
+				push_tmp("t0", across_call);
+		}
+		return;
+	}
+
+	// transmission by stack pointer
+	println("\tadd t1, t1, %d", -sz);
+
+	for (i = 0; i < n; i++) {
+		// push struct content into stack
+		println("\tld t0, %ld(a0)", i * sizeof(long));
+		println("\tsd t0, %ld(t1)", i * sizeof(long));
+	}
+	depth += n;
+
+	push("t1");
+}
+
+// Returns true if a call may happen after `arg` has been evaluated but
+// before the callee of `node` is invoked. Arguments are evaluated from
+// right to left, and the callee address comes last.
+static bool call_after_arg(struct Node *node, struct Node *arg)
+{
+	for (struct Node *n = node->args; n != arg; n = n->next)
+		if (may_call(n))
+			return true;
+
+	return may_call(node->lhs);
+}
+
+static bool is_scalar(struct Type *ty)
+{
+	return is_integer(ty) || ty->kind == TY_PTR;
+}
+
+// Returns true if an argument can be evaluated right into its
+// register: it has no side effects, calls nothing, and only clobbers
+// a0 and t0, plus fa0 if it is a floating-point value.
+static bool is_simple_arg(struct Node *node)
+{
+	if (may_call(node))
+		return false;
+
+	switch (node->kind) {
+	case ND_NUM:
+		return true;
+	case ND_VAR:
+		return is_scalar(node->ty) || is_float_arg(node->ty);
+	case ND_ADDR:
+		return node->lhs->kind == ND_VAR;
+	case ND_DEREF:
+		return (is_scalar(node->ty) || is_float_arg(node->ty)) &&
+		       is_simple_arg(node->lhs);
+	case ND_CAST:
+		if (is_float_arg(node->ty))
+			return node->ty->kind == node->lhs->ty->kind &&
+			       is_simple_arg(node->lhs);
+		return is_scalar(node->ty) && is_scalar(node->lhs->ty) &&
+		       is_simple_arg(node->lhs);
+	default:
+		return false;
+	}
+}
+
+static void gen_reg_arg(struct Node *arg)
+{
+	gen_expr(arg);
+
+	if (is_float_arg(arg->ty)) {
+		if (strcmp(arg->arg_reg, "fa0"))
+			println("\tfmv.d %s, fa0", arg->arg_reg);
+	} else if (strcmp(arg->arg_reg, "a0")) {
+		println("\tmv %s, a0", arg->arg_reg);
+	}
+}
+
+// Evaluate the arguments push_args() left for us straight into their
+// registers. Floating-point ones clobber a0 and fa0, so they go first,
+// then the integer ones, which clobber a0 only. Within each group, the
+// argument passed in a0 or fa0 itself goes last.
+static void gen_reg_args(struct Node *node)
+{
+	for (int flt = 1; flt >= 0; flt--) {
+		struct Node *last = NULL;
+
+		for (struct Node *arg = node->args; arg; arg = arg->next) {
+			if (!arg->arg_reg || is_float_arg(arg->ty) != flt)
+				continue;
+
+			if (!strcmp(arg->arg_reg, flt ? "fa0" : "a0"))
+				last = arg;
+			else
+				gen_reg_arg(arg);
+		}
+
+		if (last)
+			gen_reg_arg(last);
+	}
+}
+
+// If `spill` is set, every argument is pushed to the machine stack
+// because some of them are passed by stack. Otherwise the arguments
+// are kept in temporaries until they are moved to argument registers.
+static void push_args2(struct Node *node, struct Node *args,
+		       bool first_pass, bool spill)
+{
+	if (!args)
+		return;
+
+	// in the right-to-left order
+	push_args2(node, args->next, first_pass, spill);
+
+	if ((first_pass && !args->pass_by_stack) ||
+	   (!first_pass && args->pass_by_stack) || args->arg_reg)
+		return;
+
+	gen_expr(args);
+
+	bool across_call = call_after_arg(node, args);
+
+	switch (args->ty->kind) {
+	case TY_STRUCT:
+	case TY_UNION:
+		push_struct(args->ty, spill, across_call);
 		break;
 
 	case TY_FLOAT:
 	case TY_DOUBLE:
-		push("fa0");
+		if (spill)
+			push("fa0");
+		else
+			push_tmp("fa0", across_call);
 		break;
 
 	case TY_LDOUBLE:
-		println("\taddi sp, sp, -16");
-		println("\tfsd fs%d, 8(sp)", ld_sp - 1);
-		println("\tfsd fs%d, 0(sp)", ld_sp - 2);
-		depth += 2;
+		if (spill) {
+			println("\taddi sp, sp, -16");
+			println("\tfsd fs%d, 8(sp)", ld_sp - 1);
+			println("\tfsd fs%d, 0(sp)", ld_sp - 2);
+			depth += 2;
+		} else {
+			char hi[16], lo[16];
+			snprintf(hi, sizeof(hi), "fs%d", ld_sp - 1);
+			snprintf(lo, sizeof(lo), "fs%d", ld_sp - 2);
+			push_tmp(hi, across_call);
+			push_tmp(lo, across_call);
+		}
 		ld_sp -= 2;
 		ldsp_debug("pop_ld_stack ld_sp %d depth %d at %s:%d\n",
 			ld_sp, depth, __FILE__, __LINE__);
 		break;
 
 	default:
-		push("a0");
+		if (spill)
+			push("a0");
+		else
+			push_tmp("a0", across_call);
 		break;
 	}
 }
@@ -847,6 +1853,8 @@ static size_t push_args(struct Node *node)
 		}
 
 		if (is_float_arg(arg->ty) && (f_arg < MAX_ARG_REGS)) {
+			if (is_simple_arg(arg))
+				arg->arg_reg = argflt[f_arg];
 			f_arg++;
 
 		} else if (arg->ty->kind == TY_LDOUBLE) {
@@ -858,6 +1866,8 @@ static size_t push_args(struct Node *node)
 			}
 
 		} else if (g_arg < MAX_ARG_REGS) {
+			if (!is_float_arg(arg->ty) && is_simple_arg(arg))
+				arg->arg_reg = argreg[g_arg];
 			g_arg++;
 
 		} else {
@@ -877,36 +1887,195 @@ static size_t push_args(struct Node *node)
 	println("\tadd sp, sp, -%ld", struct_stack * sizeof(long));
 
 	// push stack arguments
-	push_args2(node->args, true);
+	push_args2(node, node->args, true, stack);
 	// push register arguments
-	push_args2(node->args, false);
+	push_args2(node, node->args, false, stack);
 
 	// If the return type is a large struct/union, the caller passes
 	// a pointer to a buffer as if it were the first argument.
 	if (node->ret_buffer && node->ty->size > 2 * (int)sizeof(long)) {
-		println("\tadd a0, fp, %d", node->ret_buffer->offset);
-		push("a0");
+		add_disp("fp", node->ret_buffer->offset);
+		if (stack)
+			push("a0");
+		else
+			push_tmp("a0", may_call(node->lhs));
 	}
 
 	return stack;
 }
 
+static void pop_arg(const char *reg, bool spill)
+{
+	if (spill)
+		pop(reg);
+	else
+		pop_tmp(reg);
+}
+
+// A call in tail position jumps to the callee after tearing down the
+// frame, so the callee returns straight to our caller. The epilogue
+// depends on the registers the whole function uses, so it is inserted
+// after `at` once the body has been generated.
+struct TailCall {
+	struct TailCall *next;
+	struct Insn *at;
+	const char *jump;
+};
+
+static struct TailCall *tail_calls;
+static struct Node *tail_call;	// the call gen_expr() is to jump to
+
+// Returns true if all arguments are passed in registers, so that
+// nothing of ours has to outlive the frame.
+static bool args_in_regs(struct Node *node)
+{
+	struct Type *cur_params = node->func_ty->params;
+	size_t g_arg = 0, f_arg = 0;
+
+	for (struct Node *arg = node->args; arg; arg = arg->next) {
+		if (node->func_ty->is_variadic && cur_params == NULL) {
+			g_arg += arg->ty->kind == TY_LDOUBLE ? 2 + g_arg % 2 : 1;
+			continue;
+		}
+		cur_params = cur_params->next;
+
+		if (is_struct_union(arg->ty)) {
+			int n = align_to(arg->ty->size, sizeof(long)) / sizeof(long);
+			if (n > 2)
+				return false;
+			g_arg += n;
+		} else if (is_float_arg(arg->ty) && f_arg < MAX_ARG_REGS) {
+			f_arg++;
+		} else {
+			g_arg += arg->ty->kind == TY_LDOUBLE ? 2 : 1;
+		}
+	}
+	return g_arg <= MAX_ARG_REGS;
+}
+
+// Returns the call `return` can jump to instead, or NULL. The frame
+// is gone by the time the callee runs, so nothing in it may have
+// been handed out, and the value has to be returned as it is.
+static struct Node *find_tail_call(struct Node *node)
+{
+	if (get_opt_O() < 1 || depth || ld_sp || tmp_depth)
+		return NULL;
+
+	if (node->kind == ND_CAST) {
+		struct Type *from = node->lhs->ty, *to = node->ty;
+		if (from->kind != to->kind || from->size != to->size ||
+		    from->is_unsigned != to->is_unsigned)
+			return NULL;
+		node = node->lhs;
+	}
+
+	if (node->kind != ND_FUNCALL || node->ret_buffer ||
+	    node->ty->kind == TY_LDOUBLE || !args_in_regs(node))
+		return NULL;
+	if (node->lhs->kind == ND_VAR && !strcmp(node->lhs->var->name, "alloca"))
+		return NULL;
+
+	if (current_fn->va_area || current_fn->alloca_bottom)
+		return NULL;
+
+	// is_addr_taken is only known once mem2reg has run
+	for (struct Obj *var = current_fn->locals; var; var = var->next) {
+		struct Type *ty = var->ty;
+		if (var->parts)
+			continue;
+		if (var->is_addr_taken || is_struct_union(ty) ||
+		    ty->kind == TY_ARRAY || ty->kind == TY_VLA)
+			return NULL;
+	}
+	return node;
+}
+
+static void gen_tail_jump(struct Obj *callee)
+{
+	struct TailCall *tc = calloc(1, sizeof(struct TailCall));
+
+	println("# tail call");
+	tc->at = current_ir->tail;
+	if (!callee)
+		tc->jump = "\tjr t1";
+	else if (get_opt_fpic() && !callee->is_static)
+		tc->jump = format("\ttail %s@plt", callee->name);
+	else
+		tc->jump = format("\ttail %s", callee->name);
+
+	tc->next = tail_calls;
+	tail_calls = tc;
+}
+
+// Point t1 at fp+offset unless [offset, offset+size) can be reached
+// from fp by displacements.
+static const char *ret_buffer_base(int *offset, int size)
+{
+	if (is_imm12(*offset) && is_imm12(*offset + size))
+		return "fp";
+
+	println("\tli t1, %d", *offset);
+	println("\tadd t1, fp, t1");
+	*offset = 0;
+	return "t1";
+}
+
+// Move the members of a struct returned in a0 and a1 straight to
+// the scalars sra split the receiving variable into.
+static void copy_ret_parts(struct Obj *var)
+{
+	int i = 0;
+
+	for (struct Member *mem = var->ty->members; mem; mem = mem->next, i++) {
+		struct Obj *part = var->parts[i];
+		const char *reg = argreg[mem->offset / sizeof(long)];
+		int shift = mem->offset % sizeof(long) * 8;
+
+		if (shift) {
+			println("\tsrli t0, %s, %d", reg, shift);
+			reg = "t0";
+		}
+
+		if (!part->reg) {
+			int offset = part->offset;
+			const char *base = ret_buffer_base(&offset, 0);
+
+			println("\t%s %s, %d(%s)", store_insn[part->ty->size],
+				reg, offset, base);
+		} else if (part->ty->kind == TY_FLOAT) {
+			println("\tfmv.w.x ft0, %s", reg);
+			store_reg_var(part, "ft0");
+		} else if (part->ty->kind == TY_DOUBLE) {
+			println("\tmv %s, %s", var_reg(part), reg);
+		} else {
+			store_reg_var(part, reg);
+		}
+	}
+}
+
 static void copy_ret_buffer(struct Obj *var)
 {
 	struct Type *ty = var->ty;
 
+	if (var->parts) {
+		copy_ret_parts(var);
+		return;
+	}
+
 	debug("copy_ret_buffer size %d", ty->size);
 
-	for (int i = 0; i < MIN((int)sizeof(long), ty->size); i++) {
-		println("\tsb a0, %d(fp)", var->offset + i);
-		println("\tsrl a0, a0, 8");
-	}
+	int offset = var->offset;
+	const char *base = ret_buffer_base(&offset, ty->size);
 
-	if (ty->size > (int)sizeof(long)) {
-		for (int i = 8; i < MIN(16, ty->size); i++) {
-			println("\tsb a1, %d(fp)", var->offset + i);
-			println("\tsrl a1, a1, 8");
-		}
+	// fp is 16-byte aligned, the offset tells how the buffer is.
+	for (int i = 0, w; i < ty->size; i += w) {
+		const char *reg = argreg[i / sizeof(long)];
+		int left = MIN(ty->size - i, (int)sizeof(long) - i % 8);
+
+		w = copy_width(sizeof(long), var->offset + i, left);
+		println("\t%s %s, %d(%s)", store_insn[w], reg, offset + i, base);
+		if (w < left)
+			println("\tsrli %s, %s, %d", reg, reg, w * 8);
 	}
 
 	debug("copy_ret_buffer end");
@@ -924,45 +2093,47 @@ static void builtin_alloca(void)
 	//      allocate t0 size
 	// ----------------------------- new alloca_bottom, return a0 as ptr
 	//
-	//             ....              memmove size t4 (t1 - t2)
+	//             ....              memmove size a2 (t1 - t2)
 	//
 	// ============================= current sp, t2
 	//           - t0 size
-	// ============================= new sp, t3
+	// ============================= new sp, a1
 
 	// t2 = current sp
 	println("\tmv t2, sp");
-	// t3 = new sp
+	// a1 = new sp
 	println("\tsub sp, sp, t0");
-	println("\tmv t3, sp");
+	println("\tmv a1, sp");
 
 	// Shift the temporary area
-	println("\tli t5, %d", current_fn->alloca_bottom->offset);
-	println("\tadd t5, t5, fp");
-	println("\tld t1, (t5)");
+	println("\tli a3, %d", current_fn->alloca_bottom->offset);
+	println("\tadd a3, a3, fp");
+	println("\tld t1, (a3)");
 
-	// t4 = old_sp - new_sp, size of local variables
-	println("\tsub t4, t1, t2");
+	// a2 = old_sp - new_sp, size of local variables
+	println("\tsub a2, t1, t2");
 
-	// memmove alloca-area from t2 to t3, size is t4
+	// memmove alloca-area from t2 to a1, size is a2
 	println("1:");
-	println("\tbeqz t4, 2f");
+	println("\tbeqz a2, 2f");
 	println("\tlb a0, 0(t2)");
-	println("\tsb a0, 0(t3)");
+	println("\tsb a0, 0(a1)");
 	println("\taddi t2, t2, 1");
-	println("\taddi t3, t3, 1");
-	println("\taddi t4, t4, -1");
+	println("\taddi a1, a1, 1");
+	println("\taddi a2, a2, -1");
 	println("\tj 1b");
 	println("2:");
 
 	// Move alloca_bottom pointer.
 	println("\tsub a0, t1, t0");
-	println("\tsd a0, (t5)");
+	println("\tsd a0, (a3)");
 }
 
 // Generate code for a given node.
 static void gen_expr(struct Node *node)
 {
+	const char *base;
+	int offset;
 	int c;
 	union {
 		float f32;
@@ -1043,30 +2214,27 @@ static void gen_expr(struct Node *node)
 		return;
 
 	case ND_VAR:
-		gen_addr(node);
-		load(node->ty);
+		if (node->var->reg) {
+			load_reg_var(node->var);
+			return;
+		}
+
+		base = gen_addr_disp(node, &offset);
+		load_from(node->ty, base, offset);
 		return;
 
 	case ND_MEMBER:
-		gen_addr(node);
-		load(node->ty);
-
-		struct Member *mem = node->member;
-		if (mem->is_bitfield) {
-			// Clear unused high bits of field member variables
-			println("\tslli a0, a0, %d", 64 - mem->bit_width - mem->bit_offset);
-			// Clear unused low bits of field member variables
-			if (mem->ty->is_unsigned)
-				println("\tsrli a0, a0, %d", 64 - mem->bit_width);
-			else
-				println("\tsrai a0, a0, %d", 64 - mem->bit_width);
-		}
+		base = gen_addr_disp(node, &offset);
+		load_from(node->ty, base, offset);
+
+		if (node->member->is_bitfield)
+			extract_bitfield(node->member);
 		return;
 
 	case ND_DEREF:
 		debug("ND_DEREF load");
-		gen_expr(node->lhs);
-		load(node->ty);
+		base = gen_addr_disp(node, &offset);
+		load_from(node->ty, base, offset);
 		debug("end ND_DEREF load");
 		return;
 
@@ -1077,50 +2245,103 @@ static void gen_expr(struct Node *node)
 		return;
 
 	case ND_ASSIGN:
-		debug("ND_ASSIGN var");
-		gen_addr(node->lhs);
-		push("a0");
-		gen_expr(node->rhs);
-
-		if (node->lhs->kind == ND_MEMBER &&
-		    node->lhs->member->is_bitfield) {
-			// save value of the bitfield
-			println("\tmv t2, a0");
-
-			// If the lhs is a bitfield, we need to read
-			// the current value from memory and merge it
-			// with a new value.
-			struct Member *mem = node->lhs->member;
-
-			debug("merge new value into bit_field");
+		if (node->lhs->kind == ND_VAR && node->lhs->var->reg) {
+			gen_expr(node->rhs);
+			store_reg_var(node->lhs->var,
+				      is_float(node->ty) ? "fa0" : "a0");
+			return;
+		}
 
-			println("\tmv t0, a0");
-			println("\tli t1, %ld", (1L << mem->bit_width) - 1);
-			println("\tand t0, t0, t1");
+		debug("ND_ASSIGN var");
+		if (is_struct_union(node->ty) || is_bitfield(node->lhs)) {
+			gen_addr(node->lhs);
+			push_tmp("a0", may_call(node->rhs));
+			gen_expr(node->rhs);
 
-			println("\tslli t0, t0, %d", mem->bit_offset);
+			if (is_bitfield(node->lhs))
+				store_bitfield(node->lhs->member, node->ty);
+			else
+				store(node->ty);
+			debug("end ND_ASSIGN var");
+			return;
+		}
 
-			// Load the address where the bit field value is saved in.
-			println("\tld a0, (sp)");
-			load(mem->ty);
+		base = gen_addr_disp(node->lhs, &offset);
+		if (!strcmp(base, "fp")) {
+			gen_expr(node->rhs);
+			store_to(node->ty, "fp", offset);
+		} else {
+			push_tmp("a0", may_call(node->rhs));
+			gen_expr(node->rhs);
+			pop_tmp("a1");
+			store_to(node->ty, "a1", offset);
+		}
+		debug("end ND_ASSIGN var");
+		return;
 
-			long mask = ((1L << mem->bit_width) - 1) << mem->bit_offset;
-			println("\tli t1, %ld", ~mask);
+	case ND_ASSIGN_OP: {
+		// The rhs computes the new value, and reads the old one
+		// through ND_LHS_VAL from the same address.
+		int outer_tmp = lhs_tmp;
+		int outer_offset = lhs_offset;
 
-			println("\tand a0, a0, t1");
-			println("\tor a0, a0, t0");
-			store(node->ty);
+		if (is_bitfield(node->lhs)) {
+			gen_addr(node->lhs);
+			base = "a0";
+			offset = 0;
+		} else {
+			base = gen_addr_disp(node->lhs, &offset);
+		}
 
-			debug("merge new value into bit_field end");
+		// fp needs no temporary
+		lhs_tmp = -1;
+		lhs_offset = offset;
+		if (strcmp(base, "fp")) {
+			push_tmp("a0", may_call(node->rhs));
+			lhs_tmp = tmp_depth - 1;
+		}
+		gen_expr(node->rhs);
+		bool in_tmp = lhs_tmp >= 0;
+		lhs_tmp = outer_tmp;
+		lhs_offset = outer_offset;
+
+		if (is_bitfield(node->lhs)) {
+			store_bitfield(node->lhs->member, node->ty);
+		} else if (in_tmp) {
+			pop_tmp("a1");
+			store_to(node->ty, "a1", offset);
+		} else {
+			store_to(node->ty, "fp", offset);
+		}
+		return;
+	}
 
-			// restore value of the bitfield
-			println("\tmv a0, t2");
-			debug("end ND_ASSIGN var");
-			return;
+	case ND_LHS_VAL:
+		if (lhs_tmp < 0) {
+			load_from(node->ty, "fp", lhs_offset);
+		} else {
+			get_tmp(lhs_tmp, "a0");
+			load_from(node->ty, "a0", lhs_offset);
 		}
+		if (node->member && node->member->is_bitfield)
+			extract_bitfield(node->member);
+		return;
 
-		store(node->ty);
-		debug("end ND_ASSIGN var");
+	case ND_POST_INC:
+		// Leave the old value in a0.
+		base = gen_addr_disp(node->lhs, &offset);
+		if (!strcmp(base, "a0")) {
+			println("\tmv t1, a0");
+			base = "t1";
+		}
+		load_from(node->ty, base, offset);
+		if (is_imm12(node->val)) {
+			println("\taddi t0, a0, %ld", node->val);
+		} else {
+			println("\tli t0, %ld", node->val);
+			println("\tadd t0, a0, t0");
+		}
+		println("\t%s t0, %d(%s)", store_insn[node->ty->size], offset, base);
 		return;
 
 	case ND_STMT_EXPR:
@@ -1139,31 +2360,40 @@ static void gen_expr(struct Node *node)
 		return;
 
 	case ND_MEMZERO:
-		debug("ND_MEMZERO size %d", node->var->ty->size);
-		for (int i = 0; i < node->var->ty->size; i++) {
-			int offset = node->var->offset + i;
-
-			if (beyond_instruction_offset(offset)) {
-				println("\tli t0, %d", offset);
-				println("\tadd t0, fp, t0");
-				println("\tsb zero, (t0)");
+		if (node->var->reg) {
+			// a float zero has to be NaN-boxed
+			if (node->var->ty->kind == TY_FLOAT) {
+				println("\tli %s, -1", var_reg(node->var));
+				println("\tslli %s, %s, 32",
+					var_reg(node->var), var_reg(node->var));
 			} else {
-				println("\tsb zero, %d(fp)", offset);
+				println("\tli %s, 0", var_reg(node->var));
 			}
+			return;
 		}
+
+		debug("ND_MEMZERO %ld...%ld", node->begin, node->end);
+		memzero(node->var->offset + node->begin,
+			node->end - node->begin);
 		debug("end ND_MEMZERO");
 		return;
 
 	case ND_COND:
 		c = count();
-		gen_expr(node->cond);
-		cmp_zero(node->cond->ty);
-		println("\tbnez a0, .L.else.%d", c);
+		gen_branch(node->cond, false, format(".L.else.%d", c));
 		gen_expr(node->then);
+		// Both branches leave a long double in a0 and a1, it goes
+		// to the stack once they have joined.
+		if (node->ty->kind == TY_LDOUBLE)
+			pop_ld();
 		println("\tj .L.end.%d", c);
 		println(".L.else.%d:", c);
 		gen_expr(node->els);
+		if (node->ty->kind == TY_LDOUBLE)
+			pop_ld();
 		println(".L.end.%d:", c);
+		if (node->ty->kind == TY_LDOUBLE)
+			push_ld();
 		return;
 
 	case ND_NOT:
@@ -1178,12 +2408,7 @@ static void gen_expr(struct Node *node)
 
 	case ND_LOGAND:
 		c = count();
-		gen_expr(node->lhs);
-		cmp_zero(node->lhs->ty);
-		println("\tbnez a0, .L.false.%d", c);
-		gen_expr(node->rhs);
-		cmp_zero(node->lhs->ty);
-		println("\tbnez a0, .L.false.%d", c);
+		gen_branch(node, false, format(".L.false.%d", c));
 		println("\tli a0, 1");
 		println("\tj .L.end.%d", c);
 		println(".L.false.%d:", c);
@@ -1193,12 +2418,7 @@ static void gen_expr(struct Node *node)
 
 	case ND_LOGOR:
 		c = count();
-		gen_expr(node->lhs);
-		cmp_zero(node->lhs->ty);
-		println("\tbeqz a0, .L.true.%d", c);
-		gen_expr(node->rhs);
-		cmp_zero(node->rhs->ty);
-		println("\tbeqz a0, .L.true.%d", c);
+		gen_branch(node, true, format(".L.true.%d", c));
 		println("\tli a0, 0");
 		println("\tj .L.end.%d", c);
 		println(".L.true.%d:", c);
@@ -1220,9 +2440,24 @@ static void gen_expr(struct Node *node)
 		// push arguments into stack first
 		int stack_args = push_args(node);
 
+		// Call a function known by name directly, so that the linker
+		// can relax the call. Only function pointers need their
+		// address in a register.
+		struct Obj *callee = NULL;
+		if (node->lhs->kind == ND_VAR && node->lhs->var->ty->kind == TY_FUNC)
+			callee = node->lhs->var;
+
 		// fetch function address
-		gen_expr(node->lhs);
-		println("\tmv t0, a0");
+		if (!callee) {
+			gen_expr(node->lhs);
+			push_tmp("a0", false);
+		}
+
+		gen_reg_args(node);
+
+		// t0 may be needed to restore registers before a tail call
+		if (!callee)
+			pop_tmp(node == tail_call ? "t1" : "t0");
 
 		struct Type *cur_params = node->func_ty->params;
 		size_t g_arg = 0, f_arg = 0;
@@ -1231,7 +2466,7 @@ static void gen_expr(struct Node *node)
 		// a pointer to a buffer as if it were the first argument.
 		if (node->ret_buffer && node->ty->size > (int)sizeof(long) * 2) {
 			debug("pop struct's pointer to a0");
-			pop(argreg[g_arg++]);
+			pop_arg(argreg[g_arg++], stack_args);
 		}
 
 		// then pop arguments from stack
@@ -1252,10 +2487,10 @@ static void gen_expr(struct Node *node)
 
 						for (int i = 0; i < 2; i++) {
 							if (g_arg < MAX_ARG_REGS)
-								pop(argreg[g_arg++]);
+								pop_arg(argreg[g_arg++], stack_args);
 						}
 					} else {
-						pop(argreg[g_arg++]);
+						pop_arg(argreg[g_arg++], stack_args);
 					}
 
 				}
@@ -1264,6 +2499,15 @@ static void gen_expr(struct Node *node)
 
 			cur_params = cur_params->next;
 
+			// already in its register
+			if (arg->arg_reg) {
+				if (is_float_arg(arg->ty))
+					f_arg++;
+				else
+					g_arg++;
+				continue;
+			}
+
 			if (is_struct_union(arg->ty)) {
 				int n = align_to(arg->ty->size, sizeof(long)) / sizeof(long);
 
@@ -1272,27 +2516,37 @@ static void gen_expr(struct Node *node)
 					while (n--) {
 						if (g_arg >= MAX_ARG_REGS)
 							break;
-						pop(argreg[g_arg++]);
+						pop_arg(argreg[g_arg++], stack_args);
 					}
 					continue;
 				}
 			}
 
 			if (is_float_arg(arg->ty) && (f_arg < MAX_ARG_REGS))
-				pop(argflt[f_arg++]);
+				pop_arg(argflt[f_arg++], stack_args);
 
 			else if (arg->ty->kind == TY_LDOUBLE) {
 				for (int i = 0; i < 2; i++) {
 					if (g_arg < MAX_ARG_REGS)
-						pop(argreg[g_arg++]);
+						pop_arg(argreg[g_arg++], stack_args);
 				}
 
 			} else if (g_arg < MAX_ARG_REGS)
-				pop(argreg[g_arg++]);
+				pop_arg(argreg[g_arg++], stack_args);
+		}
+
+		if (node == tail_call) {
+			gen_tail_jump(callee);
+			return;
 		}
 
 		// call function
-		println("\tjalr t0");
+		if (!callee)
+			println("\tjalr t0");
+		else if (get_opt_fpic() && !callee->is_static)
+			println("\tcall %s@plt", callee->name);
+		else
+			println("\tcall %s", callee->name);
 
 		if (node->ty->kind == TY_LDOUBLE)
 			push_ld();
@@ -1304,8 +2558,9 @@ static void gen_expr(struct Node *node)
 
 		// It looks like the most significant 48 or 56 bits in a0 may
 		// contain garbage if a function return type is short or bool/char,
-		// respectively. We clear the upper bits here.
-		switch (node->ty->kind) {
+		// respectively. We clear the upper bits here, unless the callee
+		// is defined here and thus returns them cleared already.
+		switch (callee && callee->is_definition ? TY_VOID : node->ty->kind) {
 		case TY_BOOL:
 		case TY_CHAR:
 			println("\tslli a0, a0, 56");
@@ -1331,8 +2586,10 @@ static void gen_expr(struct Node *node)
 		// using up to two registers.
 		if (node->ret_buffer && node->ty->size <= 2 * (int)sizeof(long)) {
 			copy_ret_buffer(node->ret_buffer);
-			debug("mv struct's pointer to a0");
-			println("\tadd a0, fp, %d", node->ret_buffer->offset);
+			if (!node->ret_buffer->parts) {
+				debug("mv struct's pointer to a0");
+				add_disp("fp", node->ret_buffer->offset);
+			}
 		}
 
 		debug("end ND_FUNCALL");
@@ -1352,9 +2609,9 @@ static void gen_expr(struct Node *node)
 		// t2: B value
 		load(node->cas_old->ty->base);
 		println("\tmv t2, a0");
-		// t3: C value
+		// a3: C value
 		gen_expr(node->cas_new);
-		println("\tmv t3, a0");
+		println("\tmv a3, a0");
 
 		c = count();
 		println(".L.cas_retry.%d:", c);
@@ -1367,33 +2624,33 @@ static void gen_expr(struct Node *node)
 		// hardware thread that occur after an atomic memory
 		// operation(AMO) will not occur before the AMO.
 
-		// t4: A value
-		println("\tlr.w.aq t4, (t0)");
-		println("\tbne t4, t2, .L.cas_return.%d", c);
+		// a4: A value
+		println("\tlr.w.aq a4, (t0)");
+		println("\tbne a4, t2, .L.cas_return.%d", c);
 
 		// sc(Store-Conditional):
 		// Writes a value from a register to a specified memory
 		// address, the write operation takes effect only if the
 		// memory address is still reserved by the processor.
-		println("\tsc.w.aq a0, t3, (t0)");
+		println("\tsc.w.aq a0, a3, (t0)");
 		println("\tbnez a0, .L.cas_retry.%d", c);
 
 		println(".L.cas_return.%d:", c);
 		// compare A value and B value
-		println("\tsubw t2, t4, t2");
+		println("\tsubw t2, a4, t2");
 		println("\tseqz a0, t2");
 		println("\tbeqz t2, .L.cas_end.%d", c);
 
 		// if not equals, write B addr with A value
-		println("\tsw t4, (t1)");
+		println("\tsw a4, (t1)");
 		println(".L.cas_end.%d:", c);
 		return;
 
 	case ND_EXCH:
 		gen_expr(node->lhs);
-		push("a0");
+		push_tmp("a0", may_call(node->rhs));
 		gen_expr(node->rhs);
-		pop("a1");
+		pop_tmp("a1");
 
 		size_t sz = node->lhs->ty->base->size;
 		println("amoswap.%s.aq a0, a0, (a1)", sz <= sizeof(int) ? "w" : "d");
@@ -1405,9 +2662,9 @@ static void gen_expr(struct Node *node)
 
 	if (is_float_arg(node->lhs->ty)) {
 		gen_expr(node->rhs);
-		push("fa0");
+		push_tmp("fa0", may_call(node->lhs));
 		gen_expr(node->lhs);
-		pop("fa1");
+		pop_tmp("fa1");
 
 		const char *sz = (node->lhs->ty->kind == TY_FLOAT) ? "s" : "d";
 
@@ -1500,12 +2757,15 @@ static void gen_expr(struct Node *node)
 		return;
 	}
 
+	if (gen_imm_binary(node))
+		return;
+
 	// left_side -> a0
 	// right_side -> a1
 	gen_expr(node->rhs);
-	push("a0");
+	push_tmp("a0", may_call(node->lhs));
 	gen_expr(node->lhs);
-	pop("a1");
+	pop_tmp("a1");
 
 	const char *suffix;
 	// if type is long or pointer
@@ -1561,7 +2821,7 @@ static void gen_expr(struct Node *node)
 			println("\tslt a0, a0, a1");
 		break;
 	case ND_LE:
-		if (node->ty->is_unsigned)
+		if (node->lhs->ty->is_unsigned)
 			println("\tsltu a0, a1, a0");
 		else
 			println("\tslt a0, a1, a0");
@@ -1628,17 +2888,173 @@ static void copy_struct_mem(void)
 	debug("get struct's pointer passed by caller");
 	println("\tld a1, %d(fp)", var->offset);
 
-	for (int i = 0; i < ty->size; i++) {
-		println("\tlb t0, %d(a0)", i);
-		println("\tsb t0, %d(a1)", i);
-	}
-
 	debug("return struct's pointer by a0");
-	println("\tmv a0, a1");
+	copy_struct(ty);
 
 	debug("copy_struct_mem end");
 }
 
+// A switch with a few cases is lowered to a series of compares.
+// Above that a dense one jumps through a table, a sparse one
+// searches the cases with a binary tree of compares.
+#define SWITCH_LINEAR_MAX 4
+#define JUMP_TABLE_MAX 4096
+
+struct JumpTable {
+	struct JumpTable *next;
+	int id;
+	int len;
+	const char **labels;
+};
+
+// tables of the current function, emitted after its text
+static struct JumpTable *jump_tables;
+
+static void gen_case_compare(struct Node *n)
+{
+	if (n->begin == n->end) {
+		println("\tli a1, %ld", n->begin);
+		println("\tbeq a0, a1, %s", n->label);
+		return;
+	}
+
+	// [GNU] Case ranges
+	debug("case %ld...%ld:", n->begin, n->end);
+	println("\tmv t1, a0");
+	println("\tli t0, %ld", n->begin);
+	// t1 = val - begin
+	println("\tsub t1, t1, t0");
+	// t2 = end - begin
+	println("\tli t2, %ld", n->end - n->begin);
+
+	// If 0 <= val - begin <= end - begin,
+	// then jump into the case label.
+	// Here is unsigned compare, so just check:
+	// unsigned (val - begin) <= unsigned (end - begin)
+	println("\tbleu t1, t2, %s", n->label);
+}
+
+// cases[lo, hi) are sorted by value.
+static void gen_case_search(struct Node **cases, int lo, int hi,
+			    const char *dflt)
+{
+	if (hi - lo <= SWITCH_LINEAR_MAX) {
+		for (int i = lo; i < hi; i++)
+			gen_case_compare(cases[i]);
+		println("\tj %s", dflt);
+		return;
+	}
+
+	int c = count();
+	int mid = (lo + hi) / 2;
+
+	println("\tli t0, %ld", cases[mid]->begin);
+	println("\tblt a0, t0, case.%d", c);
+	gen_case_search(cases, mid, hi, dflt);
+	println("case.%d:", c);
+	gen_case_search(cases, lo, mid, dflt);
+}
+
+// Jump to cases[0 ... nr-1] through a table of offsets to the labels.
+static void gen_jump_table(struct Node **cases, int nr, const char *dflt)
+{
+	struct JumpTable *jt = calloc(1, sizeof(struct JumpTable));
+	long min = cases[0]->begin;
+
+	jt->id = count();
+	jt->len = cases[nr - 1]->end - min + 1;
+	jt->labels = calloc(jt->len, sizeof(char *));
+	for (int i = 0; i < jt->len; i++)
+		jt->labels[i] = dflt;
+	for (int i = 0; i < nr; i++) {
+		for (long v = cases[i]->begin; v <= cases[i]->end; v++)
+			jt->labels[v - min] = cases[i]->label;
+		// only reachable through the table
+		cases[i]->is_label_val = true;
+	}
+	jt->next = jump_tables;
+	jump_tables = jt;
+
+	// t1 = val - min, unsigned compare checks both bounds
+	println("\tli t0, %ld", min);
+	println("\tsub t1, a0, t0");
+	println("\tli t0, %d", jt->len);
+	println("\tbgeu t1, t0, %s", dflt);
+
+	println("\tlla t0, table.%d", jt->id);
+	println("\tslli t1, t1, 2");
+	println("\tadd t1, t1, t0");
+	println("\tlw t1, 0(t1)");
+	println("\tadd t1, t1, t0");
+	println("\tjr t1");
+}
+
+static void emit_jump_tables(void)
+{
+	if (!jump_tables)
+		return;
+
+	println(".section .rodata");
+	for (struct JumpTable *jt = jump_tables; jt; jt = jt->next) {
+		println(".p2align 2");
+		println("table.%d:", jt->id);
+		for (int i = 0; i < jt->len; i++)
+			println("\t.word %s-table.%d", jt->labels[i], jt->id);
+	}
+	println(".text");
+	jump_tables = NULL;
+}
+
+static int case_cmp(const void *a, const void *b)
+{
+	long x = (*(struct Node **)a)->begin;
+	long y = (*(struct Node **)b)->begin;
+
+	return (x > y) - (x < y);
+}
+
+static void gen_switch(struct Node *node)
+{
+	const char *dflt = node->default_case ?
+			   node->default_case->label : node->brk_label;
+	int nr = 0;
+
+	gen_expr(node->cond);
+	// The case values are ints, compare 32-bit values sign-extended.
+	if (node->cond->ty->size == 4)
+		println("\tsext.w a0, a0");
+
+	for (struct Node *n = node->case_next; n; n = n->case_next)
+		nr++;
+
+	struct Node **cases = calloc(nr, sizeof(struct Node *));
+	nr = 0;
+	for (struct Node *n = node->case_next; n; n = n->case_next)
+		cases[nr++] = n;
+	qsort(cases, nr, sizeof(struct Node *), case_cmp);
+
+	long range = nr ? cases[nr - 1]->end - cases[0]->begin + 1 : 0;
+	bool sorted = true;
+	for (int i = 1; i < nr; i++)
+		if (cases[i]->begin <= cases[i - 1]->end)
+			sorted = false;
+
+	if (nr <= SWITCH_LINEAR_MAX || !sorted) {
+		// "case"s in the order they are linked
+		for (struct Node *n = node->case_next; n; n = n->case_next)
+			gen_case_compare(n);
+		println("\tj %s", dflt);
+	} else if (range <= JUMP_TABLE_MAX && range <= 3 * nr) {
+		gen_jump_table(cases, nr, dflt);
+	} else {
+		gen_case_search(cases, 0, nr, dflt);
+	}
+	free(cases);
+
+	gen_stmt(node->then);
+	println("%s:", node->brk_label);
+}
+
 static void gen_stmt(struct Node *node)
 {
 	int c;
@@ -1652,9 +3068,7 @@ static void gen_stmt(struct Node *node)
 		c = count();
 
 		debug("ND_IF");
-		gen_expr(node->cond);
-		cmp_zero(node->cond->ty);
-		println("\tbnez a0, else.%d", c);
+		gen_branch(node->cond, false, format("else.%d", c));
 
 		gen_stmt(node->then);
 		println("\tj end.%d", c);
@@ -1674,12 +3088,25 @@ static void gen_stmt(struct Node *node)
 		if (node->init)
 			gen_stmt(node->init);
 
-		println("begin.%d:", c);
-		if (node->cond) {
-			gen_expr(node->cond);
-			cmp_zero(node->cond->ty);
-			println("\tbnez a0, %s", node->brk_label);
+		// Test the condition once before the loop and then at the
+		// bottom, which saves the jump back of every iteration.
+		if (node->cond && get_opt_O() >= 1 && can_duplicate(node->cond)) {
+			gen_branch(node->cond, false, node->brk_label);
+			println("begin.%d:", c);
+			gen_stmt(node->then);
+			println("%s:", node->cont_label);
+			if (node->inc)
+				gen_expr(node->inc);
+			gen_branch(node->cond, true, format("begin.%d", c));
+
+			println("%s:", node->brk_label);
+			debug("end ND_FOR");
+			return;
 		}
+
+		println("begin.%d:", c);
+		if (node->cond)
+			gen_branch(node->cond, false, node->brk_label);
 		gen_stmt(node->then);
 		println("%s:", node->cont_label);
 		if (node->inc)
@@ -1697,50 +3124,19 @@ static void gen_stmt(struct Node *node)
 		gen_stmt(node->then);
 		println("%s:", node->cont_label);
 
-		gen_expr(node->cond);
-		cmp_zero(node->cond->ty);
-		println("\tbeqz a0, begin.%d", c);
+		gen_branch(node->cond, true, format("begin.%d", c));
 
 		println("%s:", node->brk_label);
 		return;
 
 	case ND_SWITCH:
-		gen_expr(node->cond);
-
-		for (struct Node *n = node->case_next; n; n = n->case_next) {
-			if (n->begin == n->end) {
-				println("\tli a1, %ld", n->begin);
-				println("\tbeq a0, a1, %s", n->label);
-				continue;
-			}
-
-			// [GNU] Case ranges
-			debug("case %ld...%ld:", n->begin, n->end);
-			println("\tmv t1, a0");
-			println("\tli t0, %ld", n->begin);
-			// t1 = val - begin
-			println("\tsub t1, t1, t0");
-			// t2 = end - begin
-			println("\tli t2, %ld", n->end - n->begin);
-
-			// If 0 <= val - begin <= end - begin,
-			// then jump into the case label.
-			// Here is unsigned compare, so just check:
-			// unsigned (val - begin) <= unsigned (end - begin)
-			println("\tbleu t1, t2, %s", n->label);
-		}
-
-		if (node->default_case)
-			println("\tj %s", node->default_case->label);
-
-		// "case"s are over
-		println("\tj %s", node->brk_label);
-		gen_stmt(node->then);
-		println("%s:", node->brk_label);
+		gen_switch(node);
 		return;
 
 	case ND_CASE:
 		println("%s:", node->label);
+		if (node->is_label_val)
+			current_ir->tail->is_addr_taken = true;
 		gen_stmt(node->lhs);
 		return;
 
@@ -1760,10 +3156,21 @@ static void gen_stmt(struct Node *node)
 
 	case ND_LABEL:
 		println("%s:", node->unique_label);
+		if (node->is_label_val)
+			current_ir->tail->is_addr_taken = true;
 		gen_stmt(node->lhs);
 		return;
 
-	case ND_RETURN:
+	case ND_RETURN: {
+		struct Node *call = node->lhs ? find_tail_call(node->lhs) : NULL;
+		if (call) {
+			struct Node *outer = tail_call;
+			tail_call = call;
+			gen_expr(call);
+			tail_call = outer;
+			return;
+		}
+
 		if (node->lhs) {
 			gen_expr(node->lhs);
 
@@ -1780,13 +3187,14 @@ static void gen_stmt(struct Node *node)
 		}
 		println("\tj return.%s", current_fn->name);
 		return;
+	}
 
 	case ND_EXPR_STMT:
 		gen_expr(node->lhs);
 		return;
 
 	case ND_ASM:
-		println("\t%s\n", node->asm_str);
+		ir_append_asm(current_ir, node->asm_str);
 		return;
 
 	default:
@@ -1796,6 +3204,173 @@ static void gen_stmt(struct Node *node)
 	error_tok(node->tok, "invalid statement");
 }
 
+// Scalar local variables and parameters whose address is never taken
+// are kept in registers for the whole function. Functions that make
+// no calls take t3-t6 first, then the callee-saved ones are taken from
+// the top (s11) down. The rest is left to the temporaries of
+// gen_expr().
+#define MAX_REG_VARS 8
+
+static bool has_asm;
+
+// Count the uses of local variables, and find out the ones whose
+// address is taken. `addr` is set if gen_addr() would be called on
+// the node.
+static void count_uses(struct Node *node, bool addr, int weight)
+{
+	if (!node)
+		return;
+
+	switch (node->kind) {
+	case ND_VAR:
+		if (node->var->is_local) {
+			node->var->nr_uses += weight;
+			if (addr)
+				node->var->is_addr_taken = true;
+		}
+		return;
+	case ND_VLA_PTR:
+	case ND_MEMZERO:
+		node->var->nr_uses += weight;
+		if (node->kind == ND_VLA_PTR)
+			node->var->is_addr_taken = true;
+		return;
+	case ND_ADDR:
+	case ND_MEMBER:
+		count_uses(node->lhs, true, weight);
+		return;
+	case ND_ASSIGN:
+		count_uses(node->lhs, node->lhs->kind != ND_VAR, weight);
+		count_uses(node->rhs, false, weight);
+		return;
+	case ND_ASSIGN_OP:
+	case ND_POST_INC:
+		count_uses(node->lhs, true, weight);
+		count_uses(node->rhs, false, weight);
+		return;
+	case ND_COMMA:
+		count_uses(node->lhs, false, weight);
+		count_uses(node->rhs, addr, weight);
+		return;
+	case ND_FOR:
+	case ND_DO:
+		count_uses(node->init, false, weight);
+		weight = MIN(weight * 8, 1 << 20);
+		break;
+	case ND_ASM:
+		has_asm = true;
+		return;
+	default:
+		break;
+	}
+
+	count_uses(node->lhs, false, weight);
+	count_uses(node->rhs, false, weight);
+	count_uses(node->cond, false, weight);
+	count_uses(node->then, false, weight);
+	count_uses(node->els, false, weight);
+	count_uses(node->inc, false, weight);
+	count_uses(node->cas_addr, false, weight);
+	count_uses(node->cas_old, false, weight);
+	count_uses(node->cas_new, false, weight);
+	if (node->kind != ND_FOR && node->kind != ND_DO)
+		count_uses(node->init, false, weight);
+
+	for (struct Node *n = node->body; n; n = n->next)
+		count_uses(n, false, weight);
+	for (struct Node *n = node->args; n; n = n->next)
+		count_uses(n, false, weight);
+}
+
+// the hidden pointer to the return buffer
+static bool is_ret_buffer_param(struct Obj *fn, struct Obj *var)
+{
+	struct Type *rty = fn->ty->return_ty;
+
+	return var == fn->params && is_struct_union(rty) &&
+	       rty->size > 2 * (int)sizeof(long);
+}
+
+// The stack slot of a parameter that is never used is never read
+// either. Uses are only counted from -O1 on.
+static bool is_dead_param(struct Obj *fn, struct Obj *var)
+{
+	return get_opt_O() >= 1 && !var->nr_uses && !var->is_addr_taken &&
+	       !is_ret_buffer_param(fn, var);
+}
+
+static bool is_reg_candidate(struct Obj *fn, struct Obj *var)
+{
+	struct Type *ty = var->ty;
+
+	if (var->is_addr_taken || ty->is_atomic || ty->is_volatile)
+		return false;
+
+	// These are accessed by their stack slots directly.
+	if (var == fn->alloca_bottom || var == fn->va_area)
+		return false;
+
+	if (is_ret_buffer_param(fn, var))
+		return false;
+
+	// Floating-point parameters may arrive in integer registers
+	// or on the stack, so only local ones are promoted.
+	if (ty->kind == TY_FLOAT || ty->kind == TY_DOUBLE) {
+		for (struct Obj *param = fn->params; param; param = param->next)
+			if (param == var)
+				return false;
+		return true;
+	}
+
+	return is_integer(ty) || ty->kind == TY_PTR;
+}
+
+void promote_lvars(struct Obj *prog)
+{
+	for (struct Obj *fn = prog; fn; fn = fn->next) {
+		if (!fn->is_function || !fn->is_definition)
+			continue;
+
+		has_asm = false;
+		count_uses(fn->body, false, 1);
+
+		// An asm statement may access anything in the frame.
+		if (has_asm) {
+			for (struct Obj *var = fn->locals; var; var = var->next)
+				var->is_addr_taken = true;
+			continue;
+		}
+
+		// Nothing clobbers the caller-saved registers in a function
+		// that makes no calls.
+		int regs[FIRST_CALLEE_SAVED + MAX_REG_VARS];
+		int nr_regs = 0;
+		if (!may_call(fn->body))
+			for (int i = 0; i < FIRST_CALLEE_SAVED; i++)
+				regs[nr_regs++] = i;
+		for (int i = 0; i < MAX_REG_VARS; i++)
+			regs[nr_regs++] = NR_TMP_REGS - 1 - i;
+
+		// Pick the most used candidates. A callee-saved register
+		// costs a save and a restore, so a variable has to be used
+		// at least twice to get one.
+		for (int i = 0; i < nr_regs; i++) {
+			int min_uses = regs[i] < FIRST_CALLEE_SAVED ? 1 : 2;
+			struct Obj *best = NULL;
+
+			for (struct Obj *var = fn->locals; var; var = var->next)
+				if (!var->reg && var->nr_uses >= min_uses &&
+				    is_reg_candidate(fn, var) &&
+				    (!best || var->nr_uses > best->nr_uses))
+					best = var;
+
+			if (!best)
+				break;
+			best->reg = regs[i] + 1;
+		}
+	}
+}
+
 static void assign_lvar_offsets(struct Obj *prog)
 {
 	for (struct Obj *fn = prog; fn; fn = fn->next) {
@@ -1876,7 +3451,7 @@ static void assign_lvar_offsets(struct Obj *prog)
 		// initialize var's offset
 		// Assign offsets to pass-by-register parameters and local variables.
 		for (struct Obj *var = fn->locals; var; var = var->next) {
-			if (var->offset)
+			if (var->offset || var->reg || var->parts)
 				continue;
 
 			bottom += var->ty->size;
@@ -1891,7 +3466,7 @@ static void assign_lvar_offsets(struct Obj *prog)
 static void emit_data(struct Obj *prog)
 {
 	for (struct Obj *var = prog; var; var = var->next) {
-		if (var->is_function || !var->is_definition)
+		if (var->is_function || !var->is_definition || !var->is_live)
 			continue;
 
 		if (var->is_static)
@@ -1953,11 +3528,11 @@ static void emit_data(struct Obj *prog)
 
 static void store_args(int r, int offset, int sz)
 {
-	const char *rs = "sp";
+	const char *rs = "fp";
 
 	if (beyond_instruction_offset(offset)) {
 		println("\tli t0, %d", offset);
-		println("\tadd t0, sp, t0");
+		println("\tadd t0, fp, t0");
 		rs = "t0";
 		offset = 0;
 	}
@@ -1994,11 +3569,11 @@ static void store_fltargs(size_t r, int offset, int sz)
 
 	switch (sz) {
 	case sizeof(float):
-		println("\tfsw %s, %d(sp)", argflt[r], offset);
+		println("\tfsw %s, %d(fp)", argflt[r], offset);
 		break;
 
 	case sizeof(double):
-		println("\tfsd %s, %d(sp)", argflt[r], offset);
+		println("\tfsd %s, %d(fp)", argflt[r], offset);
 		break;
 
 	default:
@@ -2007,6 +3582,124 @@ static void store_fltargs(size_t r, int offset, int sz)
 	}
 }
 
+static void save_reg(const char *insn, const char *reg, int offset)
+{
+	if (beyond_instruction_offset(offset)) {
+		println("\tli t0, %d", offset);
+		println("\tadd t0, t0, fp");
+		println("\t%s %s, (t0)", insn, reg);
+	} else {
+		println("\t%s %s, %d(fp)", insn, reg, offset);
+	}
+}
+
+// Bytes taken by the callee-saved registers which have been allocated
+// to temporaries, and the fs registers the long double stack has grown
+// into.
+static int callee_saved_size(void)
+{
+	int size = ld_sp_max * sizeof(double);
+
+	for (size_t i = FIRST_CALLEE_SAVED; i < NR_TMP_REGS; i++)
+		if (tmp_saved[i])
+			size += sizeof(long);
+	return size;
+}
+
+// Save (or restore) the callee-saved registers. Their slots are below
+// the local variables, or right above sp if there is no frame.
+static void save_callee_saved(struct Obj *fn, bool has_frame, bool restore)
+{
+	int offset = has_frame ? -fn->stack_size :
+				 align_to(callee_saved_size(), 16);
+
+	for (size_t i = FIRST_CALLEE_SAVED; i < NR_TMP_REGS; i++) {
+		if (!tmp_saved[i])
+			continue;
+
+		offset -= sizeof(long);
+		if (has_frame)
+			save_reg(restore ? "ld" : "sd", tmpreg[i], offset);
+		else
+			println("\t%s %s, %d(sp)", restore ? "ld" : "sd",
+				tmpreg[i], offset);
+	}
+
+	for (int i = 0; i < ld_sp_max; i++) {
+		char reg[16];
+		snprintf(reg, sizeof(reg), "fs%d", i);
+
+		offset -= sizeof(double);
+		if (has_frame)
+			save_reg(restore ? "fld" : "fsd", reg, offset);
+		else
+			println("\t%s %s, %d(sp)", restore ? "fld" : "fsd",
+				reg, offset);
+	}
+}
+
+// Move the promoted parameters into their registers.
+static void load_reg_params(struct Obj *fn, struct Obj **reg_args)
+{
+	static const char *load[] = {
+		[1] = "lb", [2] = "lh", [4] = "lw", [8] = "ld",
+	};
+	static const char *uload[] = {
+		[1] = "lbu", [2] = "lhu", [4] = "lwu", [8] = "ld",
+	};
+
+	for (size_t i = 0; i < MAX_ARG_REGS; i++)
+		if (reg_args[i])
+			store_reg_var(reg_args[i], argreg[i]);
+
+	// pass-by-stack parameters
+	for (struct Obj *var = fn->params; var; var = var->next) {
+		if (!var->reg || var->offset <= 0)
+			continue;
+
+		const char *insn = var->ty->is_unsigned ?
+				   uload[var->ty->size] : load[var->ty->size];
+
+		if (beyond_instruction_offset(var->offset)) {
+			println("\tli t0, %d", var->offset);
+			println("\tadd t0, t0, fp");
+			println("\t%s %s, (t0)", insn, var_reg(var));
+		} else {
+			println("\t%s %s, %d(fp)", insn, var_reg(var),
+				var->offset);
+		}
+	}
+}
+
+// Restore what the prologue has saved and pop the frame.
+static void gen_epilogue(struct Obj *fn, bool has_frame, bool is_leaf,
+			 int va_size)
+{
+	save_callee_saved(fn, has_frame, true);
+
+	int saved_size = align_to(callee_saved_size(), 16);
+	if (!has_frame && saved_size)
+		println("\tadd sp, sp, %d", saved_size);
+
+	if (has_frame) {
+		// restore sp, fp and ra registers
+		println("\tmv sp, fp");
+		if (!is_leaf)
+			println("\tld ra, 8(sp)");
+		println("\tld fp, 0(sp)");
+		println("\taddi sp, sp, 16");
+	} else if (!is_leaf) {
+		println("\tld ra, 8(sp)");
+		println("\taddi sp, sp, 16");
+	}
+
+	// return the space reserved for va_area
+	if (va_size) {
+		debug("return va_area's size is %d", va_size);
+		println("\tadd sp, sp, %d", va_size);
+	}
+}
+
 static void emit_text(struct Obj *prog)
 {
 	for (struct Obj *fn = prog; fn; fn = fn->next) {
@@ -2014,11 +3707,51 @@ static void emit_text(struct Obj *prog)
 		if (!fn->is_function || !fn->is_definition)
 			continue;
 
-		// No code is emitted for "static inline" functions
-		// if no one is referencing them.
+		// No code is emitted for unreachable static functions.
 		if (!fn->is_live)
 			continue;
 
+		current_fn = fn;
+		memset(tmp_busy, 0, sizeof(tmp_busy));
+		memset(tmp_saved, 0, sizeof(tmp_saved));
+		ld_sp_max = 0;
+		tail_calls = NULL;
+
+		// registers of promoted variables are not for temporaries
+		for (struct Obj *var = fn->locals; var; var = var->next) {
+			if (var->reg) {
+				tmp_busy[var->reg - 1] = true;
+				if (var->reg - 1 >= FIRST_CALLEE_SAVED)
+					tmp_saved[var->reg - 1] = true;
+			}
+		}
+
+		// Generate the body first, the prologue depends on which
+		// callee-saved registers end up holding temporaries.
+		struct IRFunc *body = new_ir_func(fn);
+		current_ir = body;
+
+		int pre_depth = depth;
+
+		gen_stmt(fn->body);
+
+		if (depth != pre_depth)
+			printf("pre_depth: %d != depth: %d\n",
+				pre_depth, depth);
+
+		assert(depth == pre_depth && ld_sp == 0 && tmp_depth == 0);
+
+		// [https://www.sigbus.info/n1570#5.1.2.2.3p1]
+		// The C spec defines a special rule for the main function.
+		// Reaching the end of the main function is equivalent to
+		// returning 0, even though the behavior is undefined for
+		// the other functions.
+		if (!strcmp(fn->name, "main"))
+			println("\tli a0, 0");
+
+		struct IRFunc *ir = new_ir_func(fn);
+		current_ir = ir;
+
 		println(".text");
 		println(".type %s, @function", fn->name);
 		if (fn->is_static)
@@ -2026,10 +3759,6 @@ static void emit_text(struct Obj *prog)
 		else
 			println(".global %s", fn->name);
 		println("%s:", fn->name);
-		current_fn = fn;
-
-		// Prologue
-		debug("Prologue");
 
 		int va_size = 0;
 		if (fn->va_area) {
@@ -2059,26 +3788,19 @@ static void emit_text(struct Obj *prog)
 
 			// Expand the space only when variadic parameters
 			// are transmitted by registers.
-			if (va_gp < MAX_ARG_REGS) {
+			if (va_gp < MAX_ARG_REGS)
 				va_size = (MAX_ARG_REGS - va_gp) * sizeof(long);
-				debug("va_area's size is %d", va_size);
-				println("\tadd sp, sp, -%d", va_size);
-			}
 		}
 
-		push("ra");
-		push("fp");
-		println("\tmv fp, sp");
-
-		debug("save all fs0~fs11 registers");
-		for (int i = 0; i < 12; i++)
-			println("\tfsgnj.d ft%d, fs%d, fs%d", i, i, i);
-
-		debug("Prologue end");
+		// The rest of the prologue addresses the frame by fp, it
+		// is generated first to tell whether there has to be one.
+		struct IRFunc *entry = new_ir_func(fn);
+		current_ir = entry;
 
 		// Save passed-by-register arguments to the stack
 		debug("'%s' save args into stack", fn->name);
 
+		struct Obj *reg_args[MAX_ARG_REGS] = {};
 		size_t g_arg = 0, f_arg = 0;
 		for (struct Obj *var = fn->params; var; var = var->next) {
 			// pass-by-stack parameters are already in stack now
@@ -2099,7 +3821,10 @@ static void emit_text(struct Obj *prog)
 							    var->ty->size - sizeof(long));
 
 			} else if (is_float_arg(var->ty) && (f_arg < MAX_ARG_REGS)) {
-				store_fltargs(f_arg++, var->offset, var->ty->size);
+				if (!is_dead_param(fn, var))
+					store_fltargs(f_arg, var->offset,
+						      var->ty->size);
+				f_arg++;
 
 			} else if (var->ty->kind == TY_LDOUBLE) {
 				if ((g_arg + 1) < MAX_ARG_REGS) {
@@ -2108,7 +3833,13 @@ static void emit_text(struct Obj *prog)
 				}
 
 			} else if (g_arg < MAX_ARG_REGS) {
-				store_args(g_arg++, var->offset, var->ty->size);
+				// promoted ones are moved after their
+				// registers have been saved
+				if (var->reg)
+					reg_args[g_arg] = var;
+				else if (!is_dead_param(fn, var))
+					store_args(g_arg, var->offset, var->ty->size);
+				g_arg++;
 			}
 		}
 
@@ -2130,65 +3861,107 @@ static void emit_text(struct Obj *prog)
 				fn->va_area->name);
 		}
 
-		if (beyond_instruction_offset(-fn->stack_size)) {
-			println("\tli t0, -%d", fn->stack_size);
-			println("\tadd sp, sp, t0");
-		} else {
-			println("\tadd sp, sp, -%d", fn->stack_size);
-		}
-
 		debug("'%s' save args end", fn->name);
 
+		// Promoted parameters are moved once the callee-saved
+		// registers have been saved, which is generated last.
+		struct IRFunc *params = new_ir_func(fn);
+		current_ir = params;
+
+		load_reg_params(fn, reg_args);
+
 		// record the bottom of alloca area
-		println("\tli t0, %d", fn->alloca_bottom->offset);
-		println("\tadd t0, t0, fp");
-		println("\tsd sp, (t0)");
+		if (fn->alloca_bottom) {
+			println("\tli t0, %d", fn->alloca_bottom->offset);
+			println("\tadd t0, t0, fp");
+			println("\tsd sp, (t0)");
+		}
 
-		int pre_depth = depth;
+		// A leaf function keeps ra where it is. A frame is only
+		// set up if something refers to fp, the stack slots of
+		// locals, spilled registers and stack parameters. Pushes
+		// and pops during evaluation are relative to sp.
+		uint64_t regs = ir_touched_regs(entry) |
+				ir_touched_regs(params) | ir_touched_regs(body);
+		bool is_leaf = !(regs & IR_REG(IR_RA));
+		bool has_frame = (regs & IR_REG(IR_FP)) || va_size;
 
-		// Emit code
-		gen_stmt(fn->body);
+		current_ir = entry;
+		save_callee_saved(fn, has_frame, false);
+		ir_concat(entry, params);
 
-		if (depth != pre_depth)
-			printf("pre_depth: %d != depth: %d\n",
-				pre_depth, depth);
+		current_ir = ir;
 
-		assert(depth == pre_depth && ld_sp == 0);
+		// Prologue
+		debug("Prologue");
 
-		// [https://www.sigbus.info/n1570#5.1.2.2.3p1]
-		// The C spec defines a special rule for the main function.
-		// Reaching the end of the main function is equivalent to
-		// returning 0, even though the behavior is undefined for
-		// the other functions.
-		if (!strcmp(fn->name, "main"))
-			println("\tli a0, 0");
+		if (va_size) {
+			debug("va_area's size is %d", va_size);
+			println("\tadd sp, sp, -%d", va_size);
+		}
+
+		if (has_frame) {
+			println("\taddi sp, sp, -16");
+			if (!is_leaf)
+				println("\tsd ra, 8(sp)");
+			println("\tsd fp, 0(sp)");
+			println("\tmv fp, sp");
+
+			// Callee-saved registers are saved below the local
+			// variables. Keep sp 16-byte aligned, as the
+			// alignment of outgoing arguments is derived from
+			// `depth`.
+			int frame_size = align_to(fn->stack_size +
+						  callee_saved_size(), 16);
+
+			if (beyond_instruction_offset(-frame_size)) {
+				println("\tli t0, -%d", frame_size);
+				println("\tadd sp, sp, t0");
+			} else if (frame_size) {
+				println("\tadd sp, sp, -%d", frame_size);
+			}
+		} else {
+			if (!is_leaf) {
+				println("\taddi sp, sp, -16");
+				println("\tsd ra, 8(sp)");
+			}
+
+			// Without a frame, the callee-saved registers are
+			// saved right below ra.
+			int saved_size = align_to(callee_saved_size(), 16);
+			if (saved_size)
+				println("\tadd sp, sp, -%d", saved_size);
+		}
+
+		debug("Prologue end");
+
+		ir_concat(ir, entry);
+		ir_concat(ir, body);
 
 		// epilogue
 		debug("epilogue");
 		println("return.%s:", fn->name);
 
-		debug("restore all fs0~fs11 registers");
-		for (int i = 0; i < 12; i++)
-			println("\tfsgnj.d fs%d, ft%d, ft%d", i, i, i);
-
-		// restore sp register
-		println("\tmv sp, fp");
-		// restore fp register
-		pop("fp");
-		// restore ra register
-		pop("ra");
-
-		// return the space reserved for va_area
-		if (fn->va_area && va_size) {
-			debug("return va_area's size is %d", va_size);
-			println("add sp, sp, %d", va_size);
-		}
+		gen_epilogue(fn, has_frame, is_leaf, va_size);
 
 		// mv ra to pc
 		println("\tret");
 		debug("epilogue end");
 
+		for (struct TailCall *tc = tail_calls; tc; tc = tc->next) {
+			struct IRFunc *exit = new_ir_func(fn);
+			current_ir = exit;
+			gen_epilogue(fn, has_frame, is_leaf, va_size);
+			println("%s", tc->jump);
+			ir_insert(ir, tc->at, exit);
+		}
+
 		assert(!depth);
+
+		current_ir = NULL;
+		optimize_ir(ir);
+		ir_emit(ir, output_file);
+		emit_jump_tables();
 	}
 }
 
@@ -0,0 +1,488 @@
+#include <toycc.h>
+#include <hashmap.h>
+
+// Local common subexpression elimination.
+//
+// Within a basic block, every value a register comes to hold gets a
+// number, equal numbers meaning equal values. An instruction computing
+// a value some register already holds, such as an address computed
+// once more or a second load from the same address, is replaced by a
+// move from that register, which the peephole optimizer usually
+// forwards and deletes afterwards.
+//
+// A loaded value is only reused until a store, a call or anything
+// else may have changed the memory it was read from. Two accesses
+// relative to the same base value or symbol don't alias if their
+// offsets keep them apart; any other pair may.
+//
+// As codegen computes everything in a0 and the scratch registers, a
+// value is usually gone by the time it is needed again. A first run
+// over the block only finds such values, and the second one copies
+// them to registers the function doesn't use otherwise.
+
+#define MAX_EXPRS 256
+
+// A memory operand, "off(reg)" or "sym+off"
+struct Mem {
+	const char *base;	// "%n" for value n, or the symbol
+	long off;
+	int size;
+};
+
+// A value computed in the block
+struct Expr {
+	const char *key;	// operation and the numbers of its operands
+	int val;
+	struct Insn *insn;	// where it is computed or stored
+	bool is_load;
+	struct Mem mem;		// bytes read by a load
+};
+
+struct Values {
+	int regs[IR_NR_REGS];	// the value each register holds
+	struct Expr exprs[MAX_EXPRS];
+	int nr_exprs;
+};
+
+static int nr_vals;
+static bool is_dry_run;
+static struct HashMap wanted;	// instructions whose value is lost
+static uint64_t spares;		// registers free to keep values in
+static int last_spare;
+
+static const char * const pure_ops[] = {
+	"li", "lui", "lla", "la",
+	"add", "addi", "addw", "addiw", "sub", "subw", "neg", "negw", "not",
+	"mul", "mulh", "mulhu", "mulhsu", "mulw",
+	"div", "divu", "divw", "divuw", "rem", "remu", "remw", "remuw",
+	"and", "andi", "or", "ori", "xor", "xori",
+	"sll", "slli", "sllw", "slliw", "srl", "srli", "srlw", "srliw",
+	"sra", "srai", "sraw", "sraiw",
+	"slt", "slti", "sltu", "sltiu", "seqz", "snez", "sltz", "sgtz",
+	"sext.w",
+	"fadd.s", "fadd.d", "fsub.s", "fsub.d", "fmul.s", "fmul.d",
+	"fdiv.s", "fdiv.d", "fsqrt.s", "fsqrt.d",
+	"fneg.s", "fneg.d", "fabs.s", "fabs.d",
+	"fsgnj.s", "fsgnj.d", "fsgnjn.s", "fsgnjn.d", "fsgnjx.s", "fsgnjx.d",
+	"feq.s", "feq.d", "flt.s", "flt.d", "fle.s", "fle.d",
+	"fmv.x.w", "fmv.w.x",
+};
+
+static bool is_pure(struct Insn *insn)
+{
+	if (!strncmp(insn->op, "fcvt.", 5))
+		return true;
+
+	for (size_t i = 0; i < ARRAY_SIZE(pure_ops); i++)
+		if (!strcmp(insn->op, pure_ops[i]))
+			return true;
+	return false;
+}
+
+// Whether it pays to replace an instruction by a move. A move costs
+// as much as a simple ALU instruction and keeps its source alive for
+// longer, which may stop the peephole optimizer from removing it.
+static bool is_costly(struct Insn *insn)
+{
+	static const char * const ops[] = {
+		"lla", "la", "mul", "mulh", "mulhu", "mulhsu", "mulw",
+		"div", "divu", "divw", "divuw", "rem", "remu", "remw", "remuw",
+		"fadd.s", "fadd.d", "fsub.s", "fsub.d", "fmul.s", "fmul.d",
+		"fdiv.s", "fdiv.d", "fsqrt.s", "fsqrt.d",
+	};
+
+	if (ir_is_load(insn) || !strncmp(insn->op, "fcvt.", 5))
+		return true;
+
+	// li expands to more than one instruction beyond 12 bits
+	if (ir_is(insn, "li")) {
+		char *end;
+		long val = strtol(insn->opnds[1], &end, 0);
+		return *end || val < -2048 || val > 2047;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(ops); i++)
+		if (ir_is(insn, ops[i]))
+			return true;
+	return false;
+}
+
+static bool is_float(int reg)
+{
+	return reg >= 32;
+}
+
+// Moves between registers keep all 64 bits, even from one kind of
+// register to the other.
+static bool is_move(struct Insn *insn)
+{
+	return ir_is(insn, "mv") || ir_is(insn, "fmv.d") ||
+	       ir_is(insn, "fmv.x.d") || ir_is(insn, "fmv.d.x");
+}
+
+static void new_value(struct Values *v, int reg)
+{
+	if (reg > 0)
+		v->regs[reg] = nr_vals++;
+}
+
+static void new_values(struct Values *v, uint64_t regs)
+{
+	for (int i = 1; i < IR_NR_REGS; i++)
+		if (regs & IR_REG(i))
+			new_value(v, i);
+}
+
+// Forget everything, as at the start of a block.
+static void reset(struct Values *v)
+{
+	new_values(v, ~(uint64_t)0);
+	v->nr_exprs = 0;
+}
+
+// The bytes a load or store accesses, e.g. "lhu" or "fsd".
+static int access_size(const char *op)
+{
+	size_t len = strlen(op);
+	char c = op[len - 1] == 'u' ? op[len - 2] : op[len - 1];
+
+	switch (c) {
+	case 'b': return 1;
+	case 'h': return 2;
+	case 'w': return 4;
+	default: return 8;
+	}
+}
+
+// Returns false if the operand is not understood, such as
+// "%pcrel_lo(.L.pcrel1)(a0)".
+static bool parse_mem(struct Values *v, struct Insn *insn, struct Mem *mem)
+{
+	const char *opnd = insn->opnds[1];
+	char *end;
+
+	mem->size = access_size(insn->op);
+	mem->off = strtol(opnd, &end, 0);
+
+	if (*end == '(') {
+		size_t len = strlen(end);
+		if (end[len - 1] != ')')
+			return false;
+
+		int reg = ir_reg(strndup(end + 1, len - 2));
+		if (reg < 0)
+			return false;
+		mem->base = format("%%%d", v->regs[reg]);
+		return true;
+	}
+
+	if (end != opnd || strchr(opnd, '(') || strchr(opnd, '%'))
+		return false;
+
+	const char *p = opnd + 1;
+	while (*p && *p != '+' && *p != '-')
+		p++;
+
+	mem->base = strndup(opnd, p - opnd);
+	mem->off = 0;
+	if (*p) {
+		mem->off = strtol(p, &end, 0);
+		if (*end)
+			return false;
+	}
+	return true;
+}
+
+// Distinct symbols are distinct objects. Values may point anywhere.
+static bool may_alias(struct Mem *a, struct Mem *b)
+{
+	if (strcmp(a->base, b->base))
+		return *a->base == '%' || *b->base == '%';
+	return a->off < b->off + b->size && b->off < a->off + a->size;
+}
+
+static void kill_loads(struct Values *v, struct Mem *mem)
+{
+	int n = 0;
+
+	for (int i = 0; i < v->nr_exprs; i++) {
+		struct Expr *e = &v->exprs[i];
+		if (e->is_load && (!mem || may_alias(&e->mem, mem)))
+			continue;
+		v->exprs[n++] = *e;
+	}
+	v->nr_exprs = n;
+}
+
+static struct Expr *find_expr(struct Values *v, const char *key)
+{
+	for (int i = 0; i < v->nr_exprs; i++)
+		if (!strcmp(v->exprs[i].key, key))
+			return &v->exprs[i];
+	return NULL;
+}
+
+static const char *ptr_key(void *ptr)
+{
+	return format("%p", ptr);
+}
+
+// Copy the value the first operand of `insn` holds afterwards to a
+// spare register, if it will be needed again.
+static void keep(struct IRFunc *ir, struct Values *v, struct Insn *insn)
+{
+	if (is_dry_run || !hashmap_get(&wanted, ptr_key(insn)))
+		return;
+
+	int reg = ir_reg(insn->opnds[0]);
+	for (int i = 1; i <= IR_NR_REGS; i++) {
+		int spare = (last_spare + i) % IR_NR_REGS;
+		if (!(spares & IR_REG(spare)) || is_float(spare) != is_float(reg))
+			continue;
+
+		struct IRFunc *copy = new_ir_func(ir->fn);
+		ir_append(copy, format("\t%s %s, %s",
+				       is_float(reg) ? "fmv.d" : "mv",
+				       ir_reg_name(spare), ir_reg_name(reg)));
+		ir_insert(ir, insn, copy);
+
+		v->regs[spare] = v->regs[reg];
+		last_spare = spare;
+		return;
+	}
+}
+
+static void add_expr(struct IRFunc *ir, struct Values *v, struct Insn *insn,
+		     const char *key, struct Mem *mem)
+{
+	if (v->nr_exprs == MAX_EXPRS)
+		return;
+
+	struct Expr *e = &v->exprs[v->nr_exprs++];
+	*e = (struct Expr){
+		.key = key,
+		.val = v->regs[ir_reg(insn->opnds[0])],
+		.insn = insn,
+	};
+	if (mem) {
+		e->is_load = true;
+		e->mem = *mem;
+	}
+	keep(ir, v, insn);
+}
+
+// A register of the same kind as `reg` which holds `val`, preferably
+// `reg` itself, or -1.
+static int find_holder(struct Values *v, int reg, int val)
+{
+	if (v->regs[reg] == val)
+		return reg;
+
+	int start = is_float(reg) ? 32 : 0;
+	for (int i = start; i < start + 32; i++)
+		if (v->regs[i] == val)
+			return i;
+	return -1;
+}
+
+// `insn` computes the value of `e` once more. If its destination
+// already holds it, the instruction is deleted. If some other register
+// does, it is replaced by a move from that one when that is cheaper.
+static void reuse(struct IRFunc *ir, struct Values *v, struct Insn *insn,
+		  struct Expr *e)
+{
+	int dst = ir_reg(insn->opnds[0]);
+	if (dst <= 0)
+		return;
+
+	int src = (IR_REG(dst) & IR_FIXED_REGS) ? -1 : find_holder(v, dst, e->val);
+	v->regs[dst] = e->val;
+
+	if (!is_costly(insn) && src != dst)
+		return;
+
+	if (src < 0) {
+		if (is_dry_run)
+			hashmap_put(&wanted, ptr_key(e->insn), (void *)1);
+		return;
+	}
+
+	if (is_dry_run)
+		return;
+
+	if (src == dst) {
+		ir_delete(ir, insn);
+		return;
+	}
+
+	insn->op = is_float(dst) ? "fmv.d" : "mv";
+	insn->opnds[1] = ir_reg_name(src);
+	insn->nr_opnds = 2;
+}
+
+// The operation of a pure instruction on the values of its operands.
+static const char *expr_key(struct Values *v, struct Insn *insn)
+{
+	const char *op = insn->op;
+	if (!strcmp(op, "add") && insn->nr_opnds == 3 &&
+	    ir_reg(insn->opnds[2]) < 0)
+		op = "addi";
+
+	const char *key = op;
+	for (int i = 1; i < insn->nr_opnds; i++) {
+		int reg = ir_reg(insn->opnds[i]);
+		if (reg >= 0)
+			key = format("%s %%%d", key, v->regs[reg]);
+		else
+			key = format("%s %s", key, insn->opnds[i]);
+	}
+	return key;
+}
+
+static void number_load(struct IRFunc *ir, struct Values *v, struct Insn *insn)
+{
+	struct Mem mem;
+
+	if (insn->is_volatile || insn->nr_opnds != 2 ||
+	    !parse_mem(v, insn, &mem)) {
+		new_values(v, ir_defs(insn));
+		return;
+	}
+
+	const char *key = format("%s %s%+ld", insn->op, mem.base, mem.off);
+	struct Expr *e = find_expr(v, key);
+	if (e) {
+		reuse(ir, v, insn, e);
+		return;
+	}
+
+	int dst = ir_reg(insn->opnds[0]);
+	new_value(v, dst);
+	if (dst > 0)
+		add_expr(ir, v, insn, key, &mem);
+}
+
+// A load right after a doubleword store reads back the stored value.
+static void number_store(struct IRFunc *ir, struct Values *v,
+			 struct Insn *insn)
+{
+	struct Mem mem;
+
+	if (!parse_mem(v, insn, &mem)) {
+		kill_loads(v, NULL);
+		new_values(v, ir_defs(insn));
+		return;
+	}
+
+	kill_loads(v, &mem);
+	new_values(v, ir_defs(insn));
+
+	const char *load = NULL;
+	if (ir_is(insn, "sd"))
+		load = "ld";
+	else if (ir_is(insn, "fsd"))
+		load = "fld";
+
+	int src = ir_reg(insn->opnds[0]);
+	if (load && src >= 0)
+		add_expr(ir, v, insn, format("%s %s%+ld", load, mem.base, mem.off),
+			 &mem);
+}
+
+static void number_insn(struct IRFunc *ir, struct Values *v, struct Insn *insn)
+{
+	if (insn->kind == IR_ASM) {
+		reset(v);
+		return;
+	}
+
+	if (insn->kind != IR_INSN)
+		return;
+
+	if (is_move(insn)) {
+		int dst = ir_reg(insn->opnds[0]);
+		int src = ir_reg(insn->opnds[1]);
+		if (dst > 0 && src >= 0)
+			v->regs[dst] = v->regs[src];
+		else
+			new_values(v, ir_defs(insn));
+		return;
+	}
+
+	if (ir_is_load(insn)) {
+		number_load(ir, v, insn);
+		return;
+	}
+
+	if (ir_is_store(insn)) {
+		number_store(ir, v, insn);
+		return;
+	}
+
+	// A call keeps only the callee-saved registers.
+	if (ir_is_call(insn)) {
+		kill_loads(v, NULL);
+		new_values(v, ~(IR_CALLEE_SAVED_REGS | IR_FIXED_REGS) |
+			      IR_REG(IR_RA));
+		return;
+	}
+
+	if (ir_has_side_effects(insn)) {
+		kill_loads(v, NULL);
+		new_values(v, ir_defs(insn));
+		return;
+	}
+
+	int dst = insn->nr_opnds ? ir_reg(insn->opnds[0]) : -1;
+	if (!is_pure(insn) || dst <= 0 || ir_defs(insn) != IR_REG(dst)) {
+		new_values(v, ir_defs(insn));
+		return;
+	}
+
+	const char *key = expr_key(v, insn);
+	struct Expr *e = find_expr(v, key);
+	if (e) {
+		reuse(ir, v, insn, e);
+		return;
+	}
+
+	new_value(v, dst);
+	add_expr(ir, v, insn, key, NULL);
+}
+
+static void number_blocks(struct IRFunc *ir, struct Values *v)
+{
+	ir_build_cfg(ir);
+	nr_vals = 1;	// 0 is what zero holds
+
+	for (struct BasicBlock *bb = ir->blocks; bb; bb = bb->next) {
+		struct Insn *end = bb->tail->next;
+
+		reset(v);
+		// Copies keep() inserts are skipped.
+		for (struct Insn *insn = bb->head, *next; insn != end;
+		     insn = next) {
+			next = insn->next;
+			number_insn(ir, v, insn);
+		}
+	}
+}
+
+void eliminate_common_subexprs(struct IRFunc *ir)
+{
+	struct Values *v = calloc(1, sizeof(struct Values));
+
+	// Only caller-saved registers, which need not be saved
+	spares = ~(ir_touched_regs(ir) | IR_CALLEE_SAVED_REGS | IR_FIXED_REGS);
+	last_spare = 0;
+	wanted = (struct HashMap){};
+
+	is_dry_run = true;
+	number_blocks(ir, v);
+
+	is_dry_run = false;
+	number_blocks(ir, v);
+	free(v);
+
+	peephole(ir);
+}
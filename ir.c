@@ -0,0 +1,572 @@
+#include <toycc.h>
+#include <hashmap.h>
+
+// Machine-level IR.
+//
+// codegen() emits the text of a function into an IRFunc instead of
+// writing it out directly. Each line of assembly becomes an Insn, split
+// into its mnemonic and operands, so that the optimization passes can
+// inspect and rewrite the code before it is emitted. Loads and stores
+// are explicit, as RISC-V is a load-store architecture.
+//
+// Basic blocks are views over the instruction list. They are rebuilt
+// by ir_build_cfg() whenever a pass needs them, as any change to the
+// instruction list invalidates them.
+
+struct IRFunc *new_ir_func(struct Obj *fn)
+{
+	struct IRFunc *ir = calloc(1, sizeof(struct IRFunc));
+	ir->fn = fn;
+	return ir;
+}
+
+static struct Insn *new_insn(enum InsnKind kind, const char *op)
+{
+	struct Insn *insn = calloc(1, sizeof(struct Insn));
+	insn->kind = kind;
+	insn->op = op;
+	return insn;
+}
+
+static void append_insn(struct IRFunc *ir, struct Insn *insn)
+{
+	insn->prev = ir->tail;
+	if (ir->tail)
+		ir->tail->next = insn;
+	else
+		ir->head = insn;
+	ir->tail = insn;
+}
+
+static const char *strip(const char *p, const char *end)
+{
+	while (end > p && isspace(end[-1]))
+		end--;
+	return strndup(p, end - p);
+}
+
+// Split one line of assembly into an instruction.
+static void append_line(struct IRFunc *ir, const char *p, const char *end)
+{
+	const char *start = p;
+
+	while (p < end && isspace(*p))
+		p++;
+	while (end > p && isspace(end[-1]))
+		end--;
+	if (p == end)
+		return;
+
+	// comments and directives
+	if (*p == '#' || (*p == '.' && end[-1] != ':')) {
+		append_insn(ir, new_insn(IR_DIRECTIVE, strip(start, end)));
+		return;
+	}
+
+	// labels
+	if (end[-1] == ':') {
+		append_insn(ir, new_insn(IR_LABEL, strip(p, end - 1)));
+		return;
+	}
+
+	const char *q = p;
+	while (q < end && !isspace(*q))
+		q++;
+
+	struct Insn *insn = new_insn(IR_INSN, strndup(p, q - p));
+
+	// operands are separated by commas
+	while (q < end) {
+		while (q < end && isspace(*q))
+			q++;
+		if (q == end)
+			break;
+
+		const char *r = q;
+		while (r < end && *r != ',')
+			r++;
+
+		if (insn->nr_opnds == IR_MAX_OPNDS)
+			error("too many operands: %.*s", (int)(end - p), p);
+		insn->opnds[insn->nr_opnds++] = strip(q, r);
+		q = (r < end) ? r + 1 : r;
+	}
+
+	append_insn(ir, insn);
+}
+
+// Append assembly text, which may consist of several lines.
+void ir_append(struct IRFunc *ir, const char *text)
+{
+	for (;;) {
+		const char *end = strchr(text, '\n');
+		if (!end) {
+			append_line(ir, text, text + strlen(text));
+			return;
+		}
+		append_line(ir, text, end);
+		text = end + 1;
+	}
+}
+
+// Inline assembly is opaque to the passes.
+void ir_append_asm(struct IRFunc *ir, const char *str)
+{
+	append_insn(ir, new_insn(IR_ASM, str));
+}
+
+// Move all instructions of `other` to the end of `ir`.
+void ir_concat(struct IRFunc *ir, struct IRFunc *other)
+{
+	if (!other->head)
+		return;
+
+	other->head->prev = ir->tail;
+	if (ir->tail)
+		ir->tail->next = other->head;
+	else
+		ir->head = other->head;
+	ir->tail = other->tail;
+
+	other->head = other->tail = NULL;
+}
+
+// Move all instructions of `other` after `pos` of `ir`.
+void ir_insert(struct IRFunc *ir, struct Insn *pos, struct IRFunc *other)
+{
+	if (!other->head)
+		return;
+
+	other->head->prev = pos;
+	other->tail->next = pos->next;
+	if (pos->next)
+		pos->next->prev = other->tail;
+	else
+		ir->tail = other->tail;
+	pos->next = other->head;
+
+	other->head = other->tail = NULL;
+}
+
+void ir_delete(struct IRFunc *ir, struct Insn *insn)
+{
+	if (insn->prev)
+		insn->prev->next = insn->next;
+	else
+		ir->head = insn->next;
+
+	if (insn->next)
+		insn->next->prev = insn->prev;
+	else
+		ir->tail = insn->prev;
+}
+
+bool ir_is(struct Insn *insn, const char *op)
+{
+	return insn && insn->kind == IR_INSN && !strcmp(insn->op, op);
+}
+
+bool ir_is_cond_branch(struct Insn *insn)
+{
+	static const char *ops[] = {
+		"beq", "bne", "blt", "bge", "bltu", "bgeu",
+		"bgt", "ble", "bgtu", "bleu",
+		"beqz", "bnez", "bltz", "bgez", "blez", "bgtz",
+	};
+
+	if (!insn || insn->kind != IR_INSN)
+		return false;
+
+	for (size_t i = 0; i < ARRAY_SIZE(ops); i++)
+		if (!strcmp(insn->op, ops[i]))
+			return true;
+	return false;
+}
+
+// Instructions after which control never falls through.
+bool ir_is_jump(struct Insn *insn)
+{
+	return ir_is(insn, "j") || ir_is(insn, "jr") ||
+	       ir_is(insn, "ret") || ir_is(insn, "tail");
+}
+
+// The label a branch or a direct jump refers to.
+const char *ir_branch_target(struct Insn *insn)
+{
+	if (ir_is_cond_branch(insn) || ir_is(insn, "j"))
+		return insn->opnds[insn->nr_opnds - 1];
+	return NULL;
+}
+
+// Skip comments and directives.
+struct Insn *ir_next(struct Insn *insn)
+{
+	do {
+		insn = insn->next;
+	} while (insn && insn->kind == IR_DIRECTIVE);
+	return insn;
+}
+
+struct Insn *ir_prev(struct Insn *insn)
+{
+	do {
+		insn = insn->prev;
+	} while (insn && insn->kind == IR_DIRECTIVE);
+	return insn;
+}
+
+static bool is_numeric_label(const char *name)
+{
+	for (const char *p = name; *p; p++)
+		if (!isdigit(*p))
+			return false;
+	return true;
+}
+
+// Resolve the label `name` referred to from block `bb`. Numeric
+// labels may be defined several times, "1f" and "1b" refer to the
+// nearest definition forward and backward respectively.
+static struct BasicBlock *find_block(struct IRFunc *ir, struct HashMap *map,
+				     struct BasicBlock *bb, const char *name)
+{
+	size_t len = strlen(name);
+	const char *num = strndup(name, len - 1);
+
+	if (len < 2 || !strchr("fb", name[len - 1]) || !is_numeric_label(num))
+		return hashmap_get(map, name);
+
+	struct BasicBlock *found = NULL;
+
+	if (name[len - 1] == 'f') {
+		for (struct BasicBlock *b = bb->next; b && !found; b = b->next)
+			if (b->label && !strcmp(b->label, num))
+				found = b;
+	} else {
+		for (struct BasicBlock *b = ir->blocks; b != bb->next; b = b->next)
+			if (b->label && !strcmp(b->label, num))
+				found = b;
+	}
+	return found;
+}
+
+// Split the instructions into basic blocks and link them. A block
+// starts at a label or after a branch, and has at most two
+// successors: the target of its branch and the following block.
+void ir_build_cfg(struct IRFunc *ir)
+{
+	struct BasicBlock head = {};
+	struct BasicBlock *cur = &head;
+	struct BasicBlock *bb = NULL;
+
+	for (struct Insn *insn = ir->head; insn; insn = insn->next) {
+		if (!bb || insn->kind == IR_LABEL) {
+			bb = calloc(1, sizeof(struct BasicBlock));
+			bb->head = insn;
+			if (insn->kind == IR_LABEL)
+				bb->label = insn->op;
+			cur = cur->next = bb;
+		}
+
+		bb->tail = insn;
+
+		// A label directly after a branch starts the next block.
+		if (ir_is_cond_branch(insn) || ir_is_jump(insn))
+			bb = NULL;
+	}
+	ir->blocks = head.next;
+
+	struct HashMap map = {};
+	for (bb = ir->blocks; bb; bb = bb->next)
+		if (bb->label && !is_numeric_label(bb->label))
+			hashmap_put(&map, bb->label, bb);
+
+	for (bb = ir->blocks; bb; bb = bb->next) {
+		struct Insn *last = bb->tail;
+		while (last != bb->head && last->kind == IR_DIRECTIVE)
+			last = last->prev;
+
+		int n = 0;
+		const char *target = ir_branch_target(last);
+		if (target)
+			bb->succ[n++] = find_block(ir, &map, bb, target);
+
+		bb->falls_through = !ir_is_jump(last);
+		if (bb->falls_through && bb->next)
+			bb->succ[n++] = bb->next;
+	}
+
+	for (bb = ir->blocks; bb; bb = bb->next)
+		for (int i = 0; i < 2; i++)
+			if (bb->succ[i])
+				bb->succ[i]->nr_preds++;
+}
+
+// Registers are numbered as in the instruction encoding, the integer
+// registers first and then the floating-point ones, so that a set of
+// registers fits into a uint64_t.
+static const char * const reg_names[IR_NR_REGS] = {
+	"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+	"fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+	"a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+	"s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+
+	"ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6", "ft7",
+	"fs0", "fs1", "fa0", "fa1", "fa2", "fa3", "fa4", "fa5",
+	"fa6", "fa7", "fs2", "fs3", "fs4", "fs5", "fs6", "fs7",
+	"fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11",
+};
+
+#define ARG_REGS (0xffUL << 10 | 0xffUL << 42)
+// a0, a1, fa0 and fa1 hold the return value
+#define RET_REGS (0x3UL << 10 | 0x3UL << 42 | IR_CALLEE_SAVED_REGS | IR_FIXED_REGS)
+
+// Returns the number of a register, or -1 if `name` is not one.
+int ir_reg(const char *name)
+{
+	if (!strcmp(name, "s0"))
+		return 8;
+
+	for (int i = 0; i < IR_NR_REGS; i++)
+		if (!strcmp(name, reg_names[i]))
+			return i;
+	return -1;
+}
+
+const char *ir_reg_name(int reg)
+{
+	return reg_names[reg];
+}
+
+// The register an operand refers to, either directly or as the base
+// of a memory operand such as "8(sp)".
+static int opnd_reg(const char *opnd)
+{
+	size_t len = strlen(opnd);
+
+	if (len && opnd[len - 1] == ')') {
+		const char *p = strrchr(opnd, '(');
+		return ir_reg(strndup(p + 1, opnd + len - 2 - p));
+	}
+	return ir_reg(opnd);
+}
+
+static bool is_one_of(struct Insn *insn, const char * const *ops, int n)
+{
+	if (!insn || insn->kind != IR_INSN)
+		return false;
+
+	for (int i = 0; i < n; i++)
+		if (!strcmp(insn->op, ops[i]))
+			return true;
+	return false;
+}
+
+bool ir_is_load(struct Insn *insn)
+{
+	static const char * const ops[] = {
+		"lb", "lbu", "lh", "lhu", "lw", "lwu", "ld", "flw", "fld",
+	};
+	return is_one_of(insn, ops, ARRAY_SIZE(ops));
+}
+
+bool ir_is_store(struct Insn *insn)
+{
+	static const char * const ops[] = {
+		"sb", "sh", "sw", "sd", "fsw", "fsd",
+	};
+	return is_one_of(insn, ops, ARRAY_SIZE(ops));
+}
+
+bool ir_is_call(struct Insn *insn)
+{
+	return ir_is(insn, "call") || ir_is(insn, "jalr");
+}
+
+// Instructions that must be kept even if they define no live register.
+bool ir_has_side_effects(struct Insn *insn)
+{
+	if (insn->kind != IR_INSN)
+		return true;
+
+	// Loads are kept for the sake of volatile objects.
+	if (ir_is_load(insn) || ir_is_store(insn) || ir_is_call(insn) ||
+	    ir_is_cond_branch(insn) || ir_is_jump(insn))
+		return true;
+
+	return !strncmp(insn->op, "amo", 3) || !strncmp(insn->op, "lr.", 3) ||
+	       !strncmp(insn->op, "sc.", 3) || !strncmp(insn->op, "csr", 3) ||
+	       !strcmp(insn->op, "fence") || !strcmp(insn->op, "ecall") ||
+	       !strcmp(insn->op, "ebreak");
+}
+
+// The register a load or store of a symbol, e.g. "sw a0, sym, t0",
+// has the assembler compute the address in, or -1. An integer load
+// uses its destination.
+static int scratch_reg(struct Insn *insn)
+{
+	if ((ir_is_load(insn) || ir_is_store(insn)) && insn->nr_opnds == 3)
+		return ir_reg(insn->opnds[2]);
+	return -1;
+}
+
+// Whether the first operand is the destination of the instruction.
+static bool defs_first_opnd(struct Insn *insn)
+{
+	return insn->kind == IR_INSN && insn->nr_opnds &&
+	       !ir_is_store(insn) && !ir_is_cond_branch(insn) &&
+	       !ir_is_jump(insn) && !ir_is_call(insn);
+}
+
+// Registers read by an instruction. Unknown code and indirect jumps
+// are assumed to read all of them.
+uint64_t ir_uses(struct Insn *insn)
+{
+	if (insn->kind == IR_LABEL || insn->kind == IR_DIRECTIVE)
+		return 0;
+
+	if (ir_is(insn, "ret"))
+		return RET_REGS;
+
+	if (insn->kind == IR_ASM || ir_is(insn, "jr") || ir_is(insn, "tail"))
+		return ~(uint64_t)0;
+
+	uint64_t uses = 0;
+	int nr_opnds = scratch_reg(insn) >= 0 ? 2 : insn->nr_opnds;
+	for (int i = defs_first_opnd(insn) ? 1 : 0; i < nr_opnds; i++) {
+		int reg = opnd_reg(insn->opnds[i]);
+		if (reg >= 0)
+			uses |= IR_REG(reg);
+	}
+
+	if (ir_is_call(insn))
+		uses |= ARG_REGS | IR_REG(IR_SP);
+
+	return uses & ~IR_REG(0);
+}
+
+// Registers written by an instruction. Calls only count as writing
+// the return address and the argument registers, which is enough for
+// codegen, as it keeps nothing else in caller-saved registers across
+// calls.
+uint64_t ir_defs(struct Insn *insn)
+{
+	if (ir_is_call(insn))
+		return ARG_REGS | IR_REG(1);
+
+	uint64_t defs = 0;
+	int reg = scratch_reg(insn);
+	if (reg > 0)
+		defs |= IR_REG(reg);
+
+	if (!defs_first_opnd(insn))
+		return defs;
+
+	reg = ir_reg(insn->opnds[0]);
+	return reg > 0 ? defs | IR_REG(reg) : defs;
+}
+
+static bool has_unknown_succ(struct BasicBlock *bb)
+{
+	struct Insn *last = bb->tail;
+	while (last != bb->head && last->kind == IR_DIRECTIVE)
+		last = last->prev;
+
+	if (ir_branch_target(last) && !bb->succ[0])
+		return true;
+	return bb->falls_through && !bb->next;
+}
+
+// Compute the registers live at the entry and at the exit of each block
+// by iterating to a fixed point. The CFG must be up to date.
+void ir_liveness(struct IRFunc *ir)
+{
+	int n = 0;
+	for (struct BasicBlock *bb = ir->blocks; bb; bb = bb->next)
+		n++;
+
+	struct BasicBlock **blocks = calloc(n, sizeof(struct BasicBlock *));
+	n = 0;
+	for (struct BasicBlock *bb = ir->blocks; bb; bb = bb->next) {
+		blocks[n++] = bb;
+
+		bb->gen = bb->kill = 0;
+		for (struct Insn *insn = bb->head;; insn = insn->next) {
+			bb->gen |= ir_uses(insn) & ~bb->kill;
+			bb->kill |= ir_defs(insn);
+			if (insn == bb->tail)
+				break;
+		}
+
+		bb->live_out = has_unknown_succ(bb) ? ~(uint64_t)0 : 0;
+		bb->live_in = bb->gen | (bb->live_out & ~bb->kill);
+	}
+
+	for (bool changed = true; changed;) {
+		changed = false;
+
+		for (int i = n - 1; i >= 0; i--) {
+			struct BasicBlock *bb = blocks[i];
+			uint64_t out = bb->live_out;
+
+			for (int j = 0; j < 2; j++)
+				if (bb->succ[j])
+					out |= bb->succ[j]->live_in;
+
+			if (out != bb->live_out) {
+				bb->live_out = out;
+				bb->live_in = bb->gen | (out & ~bb->kill);
+				changed = true;
+			}
+		}
+	}
+
+	free(blocks);
+}
+
+// Registers live right before `insn`, given those live after it.
+uint64_t ir_live_before(struct Insn *insn, uint64_t live_after)
+{
+	return (live_after & ~ir_defs(insn)) | ir_uses(insn);
+}
+
+bool ir_is_dead(struct Insn *insn, uint64_t live_after)
+{
+	uint64_t defs = ir_defs(insn);
+
+	return defs && !ir_has_side_effects(insn) &&
+	       !(defs & (live_after | IR_FIXED_REGS));
+}
+
+// Registers any instruction of `ir` reads or writes. A call writes ra.
+uint64_t ir_touched_regs(struct IRFunc *ir)
+{
+	uint64_t regs = 0;
+
+	for (struct Insn *insn = ir->head; insn; insn = insn->next)
+		regs |= ir_uses(insn) | ir_defs(insn);
+	return regs;
+}
+
+void ir_emit(struct IRFunc *ir, FILE *out)
+{
+	for (struct Insn *insn = ir->head; insn; insn = insn->next) {
+		switch (insn->kind) {
+		case IR_LABEL:
+			fprintf(out, "%s:\n", insn->op);
+			break;
+		case IR_DIRECTIVE:
+			fprintf(out, "%s\n", insn->op);
+			break;
+		case IR_ASM:
+			fprintf(out, "\t%s\n", insn->op);
+			break;
+		case IR_INSN:
+			fprintf(out, "\t%s", insn->op);
+			for (int i = 0; i < insn->nr_opnds; i++)
+				fprintf(out, "%s%s", i ? ", " : " ",
+					insn->opnds[i]);
+			fprintf(out, "\n");
+			break;
+		}
+	}
+}
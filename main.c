@@ -33,6 +33,7 @@ static struct StringArray std_include_paths;
 
 static bool opt_fcommon = true;
 static bool opt_fpic;
+static int opt_O;
 
 enum FileType {
 	FILE_NONE,
@@ -66,6 +67,11 @@ bool get_opt_fpic(void)
 	return opt_fpic;
 }
 
+int get_opt_O(void)
+{
+	return opt_O;
+}
+
 static void usage(int status)
 {
 	fprintf(stderr, "toycc [ -o <path> ] <file>\n");
@@ -319,6 +325,24 @@ static void parse_args(int argc, const char **argv)
 			continue;
 		}
 
+		// -O is -O1, -Os and -Oz are treated as -O2.
+		if (!strncmp(argv[i], "-O", 2)) {
+			const char *level = argv[i] + 2;
+
+			if (!*level)
+				opt_O = 1;
+			else if (isdigit(*level) && !level[1])
+				opt_O = *level - '0';
+			else if (!strcmp(level, "g"))
+				opt_O = 1;
+			else if (!strcmp(level, "s") || !strcmp(level, "z") ||
+				 !strcmp(level, "fast"))
+				opt_O = 2;
+			else
+				error("invalid optimization level: %s", argv[i]);
+			continue;
+		}
+
 		if (!strcmp(argv[i], "-cc1-input")) {
 			base_file = argv[++i];
 			continue;
@@ -368,8 +392,7 @@ static void parse_args(int argc, const char **argv)
 		}
 
 		// These options are ignored for now.
-		if (!strncmp(argv[i], "-O", 2) ||
-		    !strncmp(argv[i], "-W", 2) ||
+		if (!strncmp(argv[i], "-W", 2) ||
 		    !strncmp(argv[i], "-std=", 5) ||
 		    !strcmp(argv[i], "-g") ||
 		    !strcmp(argv[i], "-ffreestanding") ||
@@ -608,6 +631,9 @@ static void cc1(void)
 
 	struct Obj *prog = parser(tok);
 
+	// Run the optimization passes selected by -O.
+	optimize(prog);
+
 	// Open a temporary output buffer.
 	char *buf;
 	size_t buflen;
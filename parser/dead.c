@@ -0,0 +1,102 @@
+#include <parser.h>
+#include <type.h>
+#include <hashmap.h>
+
+// Dead global elimination.
+//
+// Only what can be reached from the symbols other translation units
+// see is emitted. Everything else static is dropped: unused "static
+// inline" functions at any level and, from -O1 on, also unused static
+// functions, static variables and string literals, such as the ones
+// __func__ and __FUNCTION__ create for every function.
+//
+// Objects are matched by name, as a tentative definition and the
+// actual one are two objects of the same name.
+
+static struct HashMap live;
+static bool has_asm;
+
+static bool is_root(struct Obj *var)
+{
+	if (!var->is_static)
+		return true;
+	if (var->is_function)
+		return !var->is_inline && get_opt_O() < 1;
+	return get_opt_O() < 1;
+}
+
+static void mark_refs(struct Node *node)
+{
+	if (!node)
+		return;
+
+	if (node->kind == ND_VAR && !node->var->is_local)
+		hashmap_put(&live, node->var->name, (void *)1);
+	if (node->kind == ND_ASM)
+		has_asm = true;
+
+	mark_refs(node->lhs);
+	mark_refs(node->rhs);
+	mark_refs(node->cond);
+	mark_refs(node->then);
+	mark_refs(node->els);
+	mark_refs(node->init);
+	mark_refs(node->inc);
+	mark_refs(node->cas_addr);
+	mark_refs(node->cas_old);
+	mark_refs(node->cas_new);
+	mark_refs(node->atomic_expr);
+	for (struct Node *n = node->body; n; n = n->next)
+		mark_refs(n);
+	for (struct Node *n = node->args; n; n = n->next)
+		mark_refs(n);
+}
+
+// Mark whatever a live object refers to until nothing changes.
+static void propagate(struct Obj *prog)
+{
+	bool changed = true;
+
+	while (changed) {
+		changed = false;
+
+		for (struct Obj *var = prog; var; var = var->next) {
+			if (var->is_live || !hashmap_get(&live, var->name))
+				continue;
+
+			var->is_live = true;
+			changed = true;
+
+			if (var->is_function) {
+				mark_refs(var->body);
+				continue;
+			}
+
+			for (struct Relocation *rel = var->rel; rel; rel = rel->next)
+				hashmap_put(&live, *rel->label, (void *)1);
+		}
+	}
+}
+
+void remove_dead_globals(struct Obj *prog)
+{
+	live = (struct HashMap){};
+	has_asm = false;
+
+	for (struct Obj *var = prog; var; var = var->next) {
+		var->is_live = false;
+		if (var->is_definition && is_root(var))
+			hashmap_put(&live, var->name, (void *)1);
+	}
+	propagate(prog);
+
+	// Inline assembly may refer to anything by name, so only unused
+	// "static inline" functions are dropped then, as they always are.
+	if (!has_asm || get_opt_O() < 1)
+		return;
+
+	for (struct Obj *var = prog; var; var = var->next)
+		if (!var->is_function || !var->is_inline)
+			hashmap_put(&live, var->name, (void *)1);
+	propagate(prog);
+}
@@ -19,6 +19,60 @@ struct Node *new_cast(struct Node *expr, struct Type *ty)
 	return n;
 }
 
+// Qualified copies of structs and unions made while they were still
+// incomplete, e.g. `volatile struct node *next` inside struct node.
+// They are filled in once the struct or union is defined.
+struct IncompleteCopy {
+	struct IncompleteCopy *next;
+	struct Type *ty;
+};
+
+static struct IncompleteCopy *incomplete_copies;
+
+static struct Type *qualified_copy(struct Type *ty)
+{
+	struct Type *ret = copy_type(ty);
+
+	if (is_struct_union(ty) && ty->size < 0) {
+		struct IncompleteCopy *copy = calloc(1, sizeof(struct IncompleteCopy));
+		copy->ty = ret;
+		copy->next = incomplete_copies;
+		incomplete_copies = copy;
+	}
+	return ret;
+}
+
+static void complete_copies(void)
+{
+	// A copy of a copy is completed after the copy it was made of.
+	bool changed = true;
+
+	while (changed) {
+		changed = false;
+
+		for (struct IncompleteCopy **p = &incomplete_copies; *p;) {
+			struct Type *ty = (*p)->ty;
+			struct Type *origin = ty->origin;
+
+			if (origin->size < 0) {
+				p = &(*p)->next;
+				continue;
+			}
+
+			bool is_atomic = ty->is_atomic;
+			bool is_volatile = ty->is_volatile;
+
+			*ty = *origin;
+			ty->origin = origin;
+			ty->is_atomic = is_atomic;
+			ty->is_volatile = is_volatile;
+
+			*p = (*p)->next;
+			changed = true;
+		}
+	}
+}
+
 // struct-members = (declspec declarator ("," declarator)* ";")*
 static void struct_members(struct Token **rest, struct Token *tok, struct Type *ty)
 {
@@ -217,6 +271,7 @@ static struct Type *struct_decl(struct Token **rest, struct Token *tok)
 			ty->align = mem->align;
 	}
 	ty->size = align_to(bits, ty->align * 8) / 8;
+	complete_copies();
 
 	return ty;
 }
@@ -240,6 +295,7 @@ static struct Type *union_decl(struct Token **rest, struct Token *tok)
 			ty->size = mem->ty->size;
 	}
 	ty->size = align_to(ty->size, ty->align);
+	complete_copies();
 
 	return ty;
 }
@@ -308,7 +364,9 @@ static struct Type *pointers(struct Token **rest, struct Token *tok,
 		       equal(tok, "restrict") ||
 		       equal(tok, "__restrict") ||
 		       equal(tok, "__restrict__")) {
-			// ignore
+			if (equal(tok, "volatile"))
+				ty->is_volatile = true;
+			// ignore the others
 			tok = tok->next;
 		}
 	}
@@ -393,6 +451,7 @@ bool is_typename(struct Token *tok)
 		"_Thread_local",
 		"__thread",
 		"_Atomic",
+		"__attribute__",
 	};
 
 	if (map.capacity == 0) {
@@ -421,6 +480,38 @@ static struct Type *typeof_specifier(struct Token **rest, struct Token *tok)
 	return ty;
 }
 
+// func-attribute = "__attribute__" "(" "(" ("always_inline" | "noinline")
+//		    ("," ("always_inline" | "noinline"))* ")" ")"
+static struct Token *func_attribute(struct Token *tok, struct VarAttr *attr)
+{
+	tok = skip(tok, "(");
+	tok = skip(tok, "(");
+
+	bool first = true;
+
+	while (!consume(&tok, tok, ")")) {
+		if (!first)
+			tok = skip(tok, ",");
+		first = false;
+
+		if (consume(&tok, tok, "always_inline") ||
+		    consume(&tok, tok, "__always_inline__")) {
+			attr->is_always_inline = true;
+			continue;
+		}
+
+		if (consume(&tok, tok, "noinline") ||
+		    consume(&tok, tok, "__noinline__")) {
+			attr->is_noinline = true;
+			continue;
+		}
+
+		error_tok(tok, "unknown attribute");
+	}
+
+	return skip(tok, ")");
+}
+
 // declspec = ("void" | "_Bool" | "char" | "short" | "int" | "long" |
 //		"typedef" | "static" | "extern" | "inline" |
 //		"_Thread_local" | "__thread" |
@@ -430,7 +521,7 @@ static struct Type *typeof_specifier(struct Token **rest, struct Token *tok)
 //		enum-specifier | typeof-specifier |
 //		"const" | "volatile" | "auto" | "register" |
 //		"restrict" | "__restrict" | "__restrict__" |
-//		"_Noreturn")+
+//		"_Noreturn" | func-attribute)+
 //
 // The order of typenames in a type-specifier doesn't matter. For
 // example, `int long static` means the same as `static long int`.
@@ -468,6 +559,7 @@ struct Type *declspec(struct Token **rest, struct Token *tok,
 	struct Type *ty = p_ty_int();
 	int counter = 0;
 	bool is_atomic = false;
+	bool is_volatile = false;
 
 	while (is_typename(tok)) {
 		// handle "typedef" keyword or handle storage class specifiers
@@ -497,9 +589,13 @@ struct Type *declspec(struct Token **rest, struct Token *tok,
 			continue;
 		}
 
+		if (consume(&tok, tok, "volatile")) {
+			is_volatile = true;
+			continue;
+		}
+
 		// These keywords are recognized but ignored
 		if (consume(&tok, tok, "const") ||
-		    consume(&tok, tok, "volatile") ||
 		    consume(&tok, tok, "auto") ||
 		    consume(&tok, tok, "register") ||
 		    consume(&tok, tok, "restrict") ||
@@ -534,6 +630,13 @@ struct Type *declspec(struct Token **rest, struct Token *tok,
 			continue;
 		}
 
+		if (equal(tok, "__attribute__")) {
+			if (!attr)
+				error_tok(tok, "attribute is not allowed in this context");
+			tok = func_attribute(tok->next, attr);
+			continue;
+		}
+
 		// Handle user-defined types.
 		struct Type *ty2 = find_typedef(tok);
 		if (equal(tok, "struct") ||
@@ -654,10 +757,17 @@ struct Type *declspec(struct Token **rest, struct Token *tok,
 	}
 
 	if (is_atomic) {
-		ty = copy_type(ty);
+		ty = qualified_copy(ty);
 		ty->is_atomic = true;
 	}
 
+	// The members of a volatile struct or union are volatile too,
+	// see add_type() for ND_MEMBER.
+	if (is_volatile) {
+		ty = qualified_copy(ty);
+		ty->is_volatile = true;
+	}
+
 	*rest = tok;
 	return ty;
 }
@@ -879,6 +989,7 @@ static struct Node *new_alloca(struct Node *sz)
 	node->ty = builtin_alloca->ty->return_ty;
 	node->args = sz;
 	add_type(sz);
+	use_alloca();
 	return node;
 }
 
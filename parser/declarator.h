@@ -7,6 +7,8 @@ struct VarAttr {
 	bool is_static;
 	bool is_extern;
 	bool is_inline;
+	bool is_always_inline;
+	bool is_noinline;
 	bool is_tls;
 	int align;
 };
@@ -0,0 +1,444 @@
+#include <parser.h>
+#include <type.h>
+
+// Constant folding.
+//
+// Initializers and array sizes are evaluated by eval(), but constant
+// subexpressions in function bodies, such as the index scaling that
+// new_add() creates, reach codegen as they are. This pass folds them
+// into ND_NUM bottom-up with the same rules, simplifies the algebraic
+// identities and drops the branches a constant condition never takes.
+
+static bool is_num(struct Node *node)
+{
+	return node && node->kind == ND_NUM && node->ty &&
+	       (is_integer(node->ty) || node->ty->kind == TY_PTR ||
+		is_float_arg(node->ty));
+}
+
+// Wrap a value around to the width of its type the same way a cast
+// does at run time.
+static int64_t truncate(struct Type *ty, int64_t val)
+{
+	if (ty->kind == TY_BOOL)
+		return val != 0;
+
+	if (ty->is_unsigned) {
+		switch (ty->size) {
+		case 1: return (uint8_t)val;
+		case 2: return (uint16_t)val;
+		case 4: return (uint32_t)val;
+		}
+	} else {
+		switch (ty->size) {
+		case 1: return (int8_t)val;
+		case 2: return (int16_t)val;
+		case 4: return (int32_t)val;
+		}
+	}
+	return val;
+}
+
+static long double round_float(struct Type *ty, long double val)
+{
+	if (ty->kind == TY_FLOAT)
+		return (float)val;
+	return (double)val;
+}
+
+static struct Node *new_int_of(struct Node *node, int64_t val)
+{
+	struct Node *num = new_num(truncate(node->ty, val), node->tok);
+	num->ty = node->ty;
+	return num;
+}
+
+static struct Node *new_float_of(struct Node *node, long double fval)
+{
+	struct Node *num = new_node(ND_NUM, node->tok);
+	num->fval = round_float(node->ty, fval);
+	num->ty = node->ty;
+	return num;
+}
+
+// Literals aren't always stored in the width of their type.
+static int64_t int_val(struct Node *node)
+{
+	return truncate(node->ty, node->val);
+}
+
+static long double float_val(struct Node *node)
+{
+	return round_float(node->ty, node->fval);
+}
+
+static bool is_true(struct Node *node)
+{
+	if (is_float(node->ty))
+		return float_val(node) != 0;
+	return int_val(node) != 0;
+}
+
+static bool is_unsigned(struct Type *ty)
+{
+	return ty->is_unsigned || ty->kind == TY_PTR;
+}
+
+static struct Node *fold_cast(struct Node *node)
+{
+	struct Type *from = node->lhs->ty;
+	struct Type *to = node->ty;
+
+	if (is_float_arg(to)) {
+		if (is_float(from))
+			return new_float_of(node, float_val(node->lhs));
+		if (is_unsigned(from))
+			return new_float_of(node, (uint64_t)int_val(node->lhs));
+		return new_float_of(node, int_val(node->lhs));
+	}
+
+	if (!is_integer(to) && to->kind != TY_PTR)
+		return node;
+
+	if (!is_float(from))
+		return new_int_of(node, int_val(node->lhs));
+
+	// Converting an out-of-range value is undefined, leave it to
+	// the hardware.
+	long double fval = float_val(node->lhs);
+	int bits = to->kind == TY_PTR ? 64 : to->size * 8;
+
+	if (to->kind == TY_BOOL)
+		return new_int_of(node, fval != 0);
+	if (is_unsigned(to)) {
+		if (fval <= -1 || fval >= 2.0L * (1UL << (bits - 1)))
+			return node;
+		return new_int_of(node, (uint64_t)fval);
+	}
+	if (fval <= -(long double)(1UL << (bits - 1)) - 1 ||
+	    fval >= (long double)(1UL << (bits - 1)))
+		return node;
+	return new_int_of(node, (int64_t)fval);
+}
+
+static struct Node *fold_float(struct Node *node)
+{
+	long double x = float_val(node->lhs);
+	long double y = node->rhs ? float_val(node->rhs) : 0;
+
+	// Compute in the precision of the type, so that each operation
+	// is rounded just once as it would be at run time.
+	if (node->lhs->ty->kind == TY_FLOAT) {
+		float a = x, b = y;
+
+		switch (node->kind) {
+		case ND_ADD: return new_float_of(node, a + b);
+		case ND_SUB: return new_float_of(node, a - b);
+		case ND_MUL: return new_float_of(node, a * b);
+		case ND_DIV: return new_float_of(node, a / b);
+		case ND_NEG: return new_float_of(node, -a);
+		case ND_EQ: return new_int_of(node, a == b);
+		case ND_NE: return new_int_of(node, a != b);
+		case ND_LT: return new_int_of(node, a < b);
+		case ND_LE: return new_int_of(node, a <= b);
+		default: return node;
+		}
+	}
+
+	double a = x, b = y;
+
+	switch (node->kind) {
+	case ND_ADD: return new_float_of(node, a + b);
+	case ND_SUB: return new_float_of(node, a - b);
+	case ND_MUL: return new_float_of(node, a * b);
+	case ND_DIV: return new_float_of(node, a / b);
+	case ND_NEG: return new_float_of(node, -a);
+	case ND_EQ: return new_int_of(node, a == b);
+	case ND_NE: return new_int_of(node, a != b);
+	case ND_LT: return new_int_of(node, a < b);
+	case ND_LE: return new_int_of(node, a <= b);
+	default: return node;
+	}
+}
+
+// Evaluate an operator whose operands are all constants.
+static struct Node *fold_op(struct Node *node)
+{
+	struct Node *lhs = node->lhs;
+	struct Node *rhs = node->rhs;
+
+	if (node->kind == ND_CAST)
+		return fold_cast(node);
+
+	if (is_float(lhs->ty))
+		return fold_float(node);
+
+	if (!is_integer(node->ty) && node->ty->kind != TY_PTR)
+		return node;
+
+	// Do the arithmetic unsigned, signed overflow wraps at run time.
+	int64_t sx = int_val(lhs);
+	int64_t sy = rhs ? int_val(rhs) : 0;
+	uint64_t x = sx;
+	uint64_t y = sy;
+	bool u = is_unsigned(node->ty);
+
+	switch (node->kind) {
+	case ND_ADD:
+		return new_int_of(node, x + y);
+	case ND_SUB:
+		return new_int_of(node, x - y);
+	case ND_MUL:
+		return new_int_of(node, x * y);
+	case ND_DIV:
+	case ND_MOD:
+		// Division by zero and INT_MIN / -1 trap on the host.
+		if (y == 0 || (!u && sy == -1))
+			return node;
+		if (u)
+			return new_int_of(node, node->kind == ND_DIV ? x / y : x % y);
+		if (node->kind == ND_DIV)
+			return new_int_of(node, sx / sy);
+		return new_int_of(node, sx % sy);
+	case ND_NEG:
+		return new_int_of(node, -x);
+	case ND_BITAND:
+		return new_int_of(node, x & y);
+	case ND_BITOR:
+		return new_int_of(node, x | y);
+	case ND_BITXOR:
+		return new_int_of(node, x ^ y);
+	case ND_BITNOT:
+		return new_int_of(node, ~x);
+	case ND_NOT:
+		return new_int_of(node, !x);
+	case ND_SHL:
+	case ND_SHR:
+		// The hardware takes the shift amount modulo the width.
+		if (y >= (uint64_t)node->ty->size * 8)
+			return node;
+		if (node->kind == ND_SHL)
+			return new_int_of(node, x << y);
+		if (u)
+			return new_int_of(node, x >> y);
+		return new_int_of(node, sx >> y);
+	case ND_EQ:
+		return new_int_of(node, x == y);
+	case ND_NE:
+		return new_int_of(node, x != y);
+	case ND_LT:
+		if (is_unsigned(lhs->ty))
+			return new_int_of(node, x < y);
+		return new_int_of(node, sx < sy);
+	case ND_LE:
+		if (is_unsigned(lhs->ty))
+			return new_int_of(node, x <= y);
+		return new_int_of(node, sx <= sy);
+	case ND_LOGAND:
+		return new_int_of(node, x && y);
+	case ND_LOGOR:
+		return new_int_of(node, x || y);
+	default:
+		return node;
+	}
+}
+
+static bool same_type(struct Type *t1, struct Type *t2)
+{
+	if (t1->kind == TY_PTR || t2->kind == TY_PTR)
+		return t1->kind == t2->kind;
+
+	return is_integer(t1) && is_integer(t2) && t1->size == t2->size &&
+	       t1->is_unsigned == t2->is_unsigned &&
+	       (t1->kind == TY_BOOL) == (t2->kind == TY_BOOL);
+}
+
+static bool is_const(struct Node *node, struct Node *parent, int64_t val)
+{
+	return is_num(node) && is_integer(node->ty) &&
+	       int_val(node) == truncate(parent->ty, val);
+}
+
+// Simplify an operator with one constant operand. The other operand
+// is still evaluated, so side effects are kept.
+static struct Node *simplify(struct Node *node)
+{
+	struct Node *lhs = node->lhs;
+	struct Node *rhs = node->rhs;
+
+	switch (node->kind) {
+	case ND_ADD:
+	case ND_BITOR:
+	case ND_BITXOR:
+		// x+0, 0+x
+		if (is_const(lhs, node, 0) && same_type(rhs->ty, node->ty))
+			return rhs;
+		// fallthrough
+	case ND_SUB:
+	case ND_SHL:
+	case ND_SHR:
+		// x-0, x<<0
+		if (is_const(rhs, node, 0) && same_type(lhs->ty, node->ty))
+			return lhs;
+		return node;
+	case ND_MUL:
+		// x*1, 1*x
+		if (is_const(lhs, node, 1) && same_type(rhs->ty, node->ty))
+			return rhs;
+		// fallthrough
+	case ND_DIV:
+		if (is_const(rhs, node, 1) && same_type(lhs->ty, node->ty))
+			return lhs;
+		return node;
+	case ND_BITAND:
+		// x&-1, -1&x
+		if (is_const(lhs, node, -1) && same_type(rhs->ty, node->ty))
+			return rhs;
+		if (is_const(rhs, node, -1) && same_type(lhs->ty, node->ty))
+			return lhs;
+		return node;
+	case ND_LOGAND:
+		// 0 && x
+		if (is_num(lhs) && !is_true(lhs))
+			return new_int_of(node, 0);
+		return node;
+	case ND_LOGOR:
+		// 1 || x
+		if (is_num(lhs) && is_true(lhs))
+			return new_int_of(node, 1);
+		return node;
+	default:
+		return node;
+	}
+}
+
+// A branch can't be dropped if control may enter it by a label.
+static bool has_label(struct Node *node)
+{
+	if (!node)
+		return false;
+
+	if (node->kind == ND_LABEL || node->kind == ND_CASE)
+		return true;
+
+	if (has_label(node->lhs) || has_label(node->rhs) ||
+	    has_label(node->cond) || has_label(node->then) ||
+	    has_label(node->els) || has_label(node->init) ||
+	    has_label(node->inc))
+		return true;
+
+	for (struct Node *n = node->body; n; n = n->next)
+		if (has_label(n))
+			return true;
+	for (struct Node *n = node->args; n; n = n->next)
+		if (has_label(n))
+			return true;
+	return false;
+}
+
+static void fold(struct Node **np);
+
+static void fold_list(struct Node **np)
+{
+	for (; *np; np = &(*np)->next)
+		fold(np);
+}
+
+static struct Node *fold_node(struct Node *node)
+{
+	switch (node->kind) {
+	case ND_ADD:
+	case ND_SUB:
+	case ND_MUL:
+	case ND_DIV:
+	case ND_MOD:
+	case ND_BITAND:
+	case ND_BITOR:
+	case ND_BITXOR:
+	case ND_SHL:
+	case ND_SHR:
+	case ND_EQ:
+	case ND_NE:
+	case ND_LT:
+	case ND_LE:
+	case ND_LOGAND:
+	case ND_LOGOR:
+		if (is_num(node->lhs) && is_num(node->rhs))
+			return fold_op(node);
+		return simplify(node);
+
+	case ND_NEG:
+	case ND_NOT:
+	case ND_BITNOT:
+	case ND_CAST:
+		if (is_num(node->lhs))
+			return fold_op(node);
+		return node;
+
+	case ND_COND:
+		// A struct operand may be a cast codegen can't take the
+		// address of.
+		if (!is_num(node->cond) || is_struct_union(node->ty))
+			return node;
+		if (has_label(is_true(node->cond) ? node->els : node->then))
+			return node;
+		return is_true(node->cond) ? node->then : node->els;
+
+	case ND_IF: {
+		if (!is_num(node->cond))
+			return node;
+
+		struct Node *live = is_true(node->cond) ? node->then : node->els;
+		struct Node *dead = is_true(node->cond) ? node->els : node->then;
+
+		if (has_label(dead))
+			return node;
+		if (live)
+			return live;
+		return new_node(ND_BLOCK, node->tok);
+	}
+
+	case ND_FOR:
+		// for (;1;) is for (;;)
+		if (is_num(node->cond) && is_true(node->cond))
+			node->cond = NULL;
+		return node;
+
+	default:
+		return node;
+	}
+}
+
+static void fold(struct Node **np)
+{
+	struct Node *node = *np;
+
+	if (!node)
+		return;
+
+	fold(&node->lhs);
+	fold(&node->rhs);
+	fold(&node->cond);
+	fold(&node->then);
+	fold(&node->els);
+	fold(&node->init);
+	fold(&node->inc);
+	fold(&node->cas_addr);
+	fold(&node->cas_old);
+	fold(&node->cas_new);
+	fold_list(&node->body);
+	fold_list(&node->args);
+
+	struct Node *new = fold_node(node);
+	if (new != node) {
+		new->next = node->next;
+		*np = new;
+	}
+}
+
+void fold_constants(struct Obj *prog)
+{
+	for (struct Obj *fn = prog; fn; fn = fn->next)
+		if (fn->is_function && fn->is_definition)
+			fold(&fn->body);
+}
@@ -591,6 +591,107 @@ static struct Node *create_lvar_init(struct Initializer *init, struct Type *ty,
 	return new_binary(ND_ASSIGN, lhs, rhs, tok);
 }
 
+// Mark the bytes an initializer overwrites as a whole. Bitfields are
+// merged into the memory they share, so they don't count.
+static void mark_init(struct Initializer *init, struct Type *ty,
+		      int offset, bool *covered)
+{
+	if (ty->kind == TY_ARRAY) {
+		for (int i = 0; i < ty->array_len; i++)
+			mark_init(init->children[i], ty->base,
+				  offset + ty->base->size * i, covered);
+		return;
+	}
+
+	if (ty->kind == TY_STRUCT && !init->expr) {
+		for (struct Member *mem = ty->members; mem; mem = mem->next)
+			if (!mem->is_bitfield)
+				mark_init(init->children[mem->idx], mem->ty,
+					  offset + mem->offset, covered);
+		return;
+	}
+
+	if (ty->kind == TY_UNION) {
+		struct Member *mem = init->mem ? init->mem : ty->members;
+		mark_init(init->children[mem->idx], mem->ty, offset, covered);
+		return;
+	}
+
+	if (init->expr)
+		memset(covered + offset, true, ty->size);
+}
+
+// Drop the initializers storing an integer zero to an object that is
+// cleared as a whole anyway.
+static void drop_zero_init(struct Initializer *init, struct Type *ty)
+{
+	if (ty->kind == TY_ARRAY) {
+		for (int i = 0; i < ty->array_len; i++)
+			drop_zero_init(init->children[i], ty->base);
+		return;
+	}
+
+	if (ty->kind == TY_STRUCT && !init->expr) {
+		for (struct Member *mem = ty->members; mem; mem = mem->next)
+			drop_zero_init(init->children[mem->idx], mem->ty);
+		return;
+	}
+
+	if (ty->kind == TY_UNION) {
+		struct Member *mem = init->mem ? init->mem : ty->members;
+		drop_zero_init(init->children[mem->idx], mem->ty);
+		return;
+	}
+
+	struct Node *expr = init->expr;
+	if (!expr || expr->kind != ND_NUM)
+		return;
+
+	add_type(expr);
+	if (is_integer(expr->ty) && !expr->val &&
+	    (is_integer(ty) || ty->kind == TY_PTR))
+		init->expr = NULL;
+}
+
+// Zero-clear the bytes of var the initializer leaves alone.
+static struct Node *zero_uncovered(struct Initializer *init,
+				   struct Obj *var, struct Token *tok)
+{
+	int size = var->ty->size;
+	bool *covered = calloc(size, sizeof(bool));
+	struct Node *node = new_node(ND_NULL_EXPR, tok);
+
+	mark_init(init, var->ty, 0, covered);
+
+	// A mostly zero object is cleared as a whole, which takes a single
+	// aligned clear instead of one for each gap between initializers.
+	int nr_zero = 0;
+	for (int i = 0; i < size; i++)
+		nr_zero += !covered[i];
+	if (nr_zero > size / 2 && !var->ty->is_volatile) {
+		memset(covered, false, size);
+		drop_zero_init(init, var->ty);
+	}
+
+	for (int i = 0; i < size;) {
+		if (covered[i]) {
+			i++;
+			continue;
+		}
+
+		struct Node *zero = new_node(ND_MEMZERO, tok);
+		zero->var = var;
+		zero->begin = i;
+		while (i < size && !covered[i])
+			i++;
+		zero->end = i;
+		node = new_binary(ND_COMMA, node, zero, tok);
+	}
+
+	free(covered);
+	return node;
+}
+
 // A variable definition with an initializer is a shorthand notation
 // for a variable definition followed by assignments. This function
 // generates assignment expressions for an initializer. For example,
@@ -609,10 +710,9 @@ struct Node *lvar_initializer(struct Token **rest, struct Token *tok,
 
 	// If a partial initializer list is given, the standard requires
 	// that unspecified elements are set to 0. Here, we simply
-	// zero-initialize the entire memory region of a variable before
-	// initializing it with user-supplied values.
-	struct Node *lhs = new_node(ND_MEMZERO, tok);
-	lhs->var = var;
+	// zero-initialize the memory region of a variable that isn't
+	// overwritten by user-supplied values.
+	struct Node *lhs = zero_uncovered(init, var, tok);
 
 	// initializing var with user-supplied values.
 	struct Node *rhs = create_lvar_init(init, var->ty, &desg, tok);
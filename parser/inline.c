@@ -0,0 +1,407 @@
+#include <parser.h>
+#include <type.h>
+#include <hashmap.h>
+
+// Function inlining.
+//
+// A call to a function whose body is known is replaced by a copy of
+// that body. The copy gets fresh locals of the caller for the callee's
+// parameters and locals, the arguments are assigned to the parameters
+// up front, and each "return" becomes an assignment to a result
+// variable followed by a jump to the end of the copy:
+//
+//   ({ p1 = arg1; ...; { body }; end: ret; })
+//
+// always_inline functions are inlined at any level, other "inline"
+// functions from -O1 on and small static functions from -O2 on.
+// noinline functions never are.
+
+#define MAX_DEPTH 8
+#define INLINE_SIZE 60	// nodes a function declared "inline" may have
+#define STATIC_SIZE 30	// nodes any other static function may have
+
+// The functions being inlined into, innermost last.
+static struct Obj *stack[MAX_DEPTH + 1];
+static int depth;
+
+static int count_nodes(struct Node *node)
+{
+	if (!node)
+		return 0;
+
+	int n = 1;
+	n += count_nodes(node->lhs) + count_nodes(node->rhs);
+	n += count_nodes(node->cond) + count_nodes(node->then);
+	n += count_nodes(node->els) + count_nodes(node->init);
+	n += count_nodes(node->inc);
+	n += count_nodes(node->cas_addr) + count_nodes(node->cas_old);
+	n += count_nodes(node->cas_new) + count_nodes(node->atomic_expr);
+	for (struct Node *cur = node->body; cur; cur = cur->next)
+		n += count_nodes(cur);
+	for (struct Node *cur = node->args; cur; cur = cur->next)
+		n += count_nodes(cur);
+	return n;
+}
+
+// Returns true if a copy of the node would not behave the same, such
+// as an asm statement whose labels would be defined twice, or a label
+// that may be jumped to from outside the function.
+static bool has_unique(struct Node *node)
+{
+	if (!node)
+		return false;
+
+	switch (node->kind) {
+	case ND_ASM:
+	case ND_GOTO_EXPR:
+	case ND_LABEL_VAL:
+	case ND_VLA_PTR:
+		return true;
+	case ND_LABEL:
+		if (node->is_label_val)
+			return true;
+		break;
+	default:
+		break;
+	}
+
+	if (has_unique(node->lhs) || has_unique(node->rhs) ||
+	    has_unique(node->cond) || has_unique(node->then) ||
+	    has_unique(node->els) || has_unique(node->init) ||
+	    has_unique(node->inc) || has_unique(node->cas_addr) ||
+	    has_unique(node->cas_old) || has_unique(node->cas_new) ||
+	    has_unique(node->atomic_expr))
+		return true;
+
+	for (struct Node *cur = node->body; cur; cur = cur->next)
+		if (has_unique(cur))
+			return true;
+	for (struct Node *cur = node->args; cur; cur = cur->next)
+		if (has_unique(cur))
+			return true;
+	return false;
+}
+
+// Long doubles live on a stack of their own in codegen, which an
+// assignment used as a statement would leave unbalanced.
+static bool is_passable(struct Type *ty)
+{
+	return ty->kind != TY_LDOUBLE && ty->kind != TY_VLA;
+}
+
+static struct Obj *get_callee(struct Node *node)
+{
+	struct Node *lhs = node->lhs;
+
+	if (lhs->kind != ND_VAR || lhs->var->ty->kind != TY_FUNC)
+		return NULL;
+	return lhs->var;
+}
+
+static bool can_inline(struct Node *node, struct Obj *fn)
+{
+	if (!fn->is_definition || !fn->body || fn->is_noinline)
+		return false;
+
+	if (!fn->is_always_inline) {
+		int size;
+
+		if (get_opt_O() >= 1 && fn->is_inline)
+			size = INLINE_SIZE;
+		else if (get_opt_O() >= 2 && fn->is_static)
+			size = STATIC_SIZE;
+		else
+			return false;
+
+		if (count_nodes(fn->body) > size)
+			return false;
+	}
+
+	if (depth > MAX_DEPTH - 1)
+		return false;
+	for (int i = 0; i < depth; i++)
+		if (stack[i] == fn)
+			return false;
+
+	struct Type *rty = fn->ty->return_ty;
+	if (fn->ty->is_variadic || fn->va_area || fn->alloca_bottom ||
+	    is_struct_union(rty) || !is_passable(rty))
+		return false;
+
+	for (struct Obj *var = fn->locals; var; var = var->next)
+		if (!is_passable(var->ty) || var->ty->vla_size)
+			return false;
+
+	// Arguments must already have their parameter's type, which
+	// a call through an unprototyped declaration does not ensure.
+	struct Node *arg = node->args;
+	for (struct Obj *param = fn->params; param; param = param->next) {
+		if (!arg)
+			return false;
+		add_type(arg);
+		if (!is_compatible(arg->ty, param->ty))
+			return false;
+		arg = arg->next;
+	}
+	if (arg)
+		return false;
+
+	return !has_unique(fn->body);
+}
+
+// The mapping from the callee's locals, labels and case nodes
+// to those of the copy.
+struct Clone {
+	struct HashMap map;
+	struct Node **cloned;	// the copies made so far
+	int len;
+	int capacity;
+	struct Obj *ret;	// result variable, NULL if void
+	const char *end_label;
+};
+
+static const char *key(void *ptr)
+{
+	return format("%p", ptr);
+}
+
+static struct Obj *clone_var(struct Clone *c, struct Obj *var)
+{
+	if (!var || !var->is_local)
+		return var;
+
+	struct Obj *new = hashmap_get(&c->map, key(var));
+	if (!new)
+		unreachable();
+	return new;
+}
+
+static const char *clone_label(struct Clone *c, const char *label)
+{
+	if (!label)
+		return NULL;
+
+	const char *new = hashmap_get(&c->map, label);
+	if (!new) {
+		new = new_unique_name();
+		hashmap_put(&c->map, label, (void *)new);
+	}
+	return new;
+}
+
+static struct Node *clone(struct Clone *c, struct Node *node);
+
+static struct Node *clone_list(struct Clone *c, struct Node *node)
+{
+	struct Node head = {};
+	struct Node *cur = &head;
+
+	for (; node; node = node->next)
+		cur = cur->next = clone(c, node);
+	return head.next;
+}
+
+// return x; => { ret = x; goto end; }
+static struct Node *clone_return(struct Clone *c, struct Node *node)
+{
+	struct Node *jump = new_node(ND_GOTO, node->tok);
+	jump->unique_label = c->end_label;
+
+	struct Node *block = new_node(ND_BLOCK, node->tok);
+	block->body = jump;
+
+	if (node->lhs) {
+		struct Node *exp = clone(c, node->lhs);
+		if (c->ret)
+			exp = new_binary(ND_ASSIGN, new_var_node(c->ret, node->tok),
+					 exp, node->tok);
+		add_type(exp);
+
+		struct Node *stmt = new_unary(ND_EXPR_STMT, exp, node->tok);
+		stmt->next = jump;
+		block->body = stmt;
+	}
+	return block;
+}
+
+static struct Node *clone(struct Clone *c, struct Node *node)
+{
+	if (!node)
+		return NULL;
+
+	if (node->kind == ND_RETURN)
+		return clone_return(c, node);
+
+	struct Node *new = calloc(1, sizeof(struct Node));
+	*new = *node;
+	new->next = NULL;
+
+	new->lhs = clone(c, node->lhs);
+	new->rhs = clone(c, node->rhs);
+	new->cond = clone(c, node->cond);
+	new->then = clone(c, node->then);
+	new->els = clone(c, node->els);
+	new->init = clone(c, node->init);
+	new->inc = clone(c, node->inc);
+	new->body = clone_list(c, node->body);
+	new->args = clone_list(c, node->args);
+	new->cas_addr = clone(c, node->cas_addr);
+	new->cas_old = clone(c, node->cas_old);
+	new->cas_new = clone(c, node->cas_new);
+	new->atomic_expr = clone(c, node->atomic_expr);
+
+	new->var = clone_var(c, node->var);
+	new->ret_buffer = clone_var(c, node->ret_buffer);
+	new->atomic_addr = clone_var(c, node->atomic_addr);
+
+	new->brk_label = clone_label(c, node->brk_label);
+	new->cont_label = clone_label(c, node->cont_label);
+	new->unique_label = clone_label(c, node->unique_label);
+	if (node->kind == ND_CASE)
+		new->label = clone_label(c, node->label);
+
+	if (c->len == c->capacity) {
+		c->capacity = c->capacity ? c->capacity * 2 : 16;
+		c->cloned = realloc(c->cloned, sizeof(struct Node *) * c->capacity);
+	}
+	c->cloned[c->len++] = new;
+	hashmap_put(&c->map, key(node), new);
+	return new;
+}
+
+static struct Node *cloned_node(struct Clone *c, struct Node *node)
+{
+	if (!node)
+		return NULL;
+	return hashmap_get(&c->map, key(node));
+}
+
+static struct Obj *new_local(struct Obj *fn, const char *name, struct Type *ty)
+{
+	struct Obj *var = calloc(1, sizeof(struct Obj));
+
+	var->name = name;
+	var->ty = ty;
+	var->align = ty->align;
+	var->is_local = true;
+	var->next = fn->locals;
+	fn->locals = var;
+	return var;
+}
+
+static struct Node *inline_call(struct Obj *caller, struct Node *node,
+				struct Obj *callee)
+{
+	struct Token *tok = node->tok;
+	struct Clone c = {};
+	struct Node head = {};
+	struct Node *cur = &head;
+
+	for (struct Obj *var = callee->locals; var; var = var->next) {
+		struct Obj *new = new_local(caller, var->name, var->ty);
+		new->align = var->align;
+		hashmap_put(&c.map, key(var), new);
+	}
+
+	// Bind the arguments to the copies of the parameters.
+	struct Node *arg = node->args;
+	for (struct Obj *param = callee->params; param; param = param->next) {
+		struct Node *next = arg->next;
+		arg->next = NULL;
+
+		struct Node *exp = new_binary(ND_ASSIGN,
+					      new_var_node(clone_var(&c, param), tok),
+					      arg, tok);
+		add_type(exp);
+		cur = cur->next = new_unary(ND_EXPR_STMT, exp, tok);
+		arg = next;
+	}
+
+	struct Type *rty = callee->ty->return_ty;
+	if (rty->kind != TY_VOID)
+		c.ret = new_local(caller, "", rty);
+	c.end_label = new_unique_name();
+
+	cur = cur->next = clone(&c, callee->body);
+
+	for (int i = 0; i < c.len; i++) {
+		struct Node *new = c.cloned[i];
+		new->case_next = cloned_node(&c, new->case_next);
+		new->default_case = cloned_node(&c, new->default_case);
+	}
+	free(c.cloned);
+
+	struct Node *end = new_node(ND_LABEL, tok);
+	end->unique_label = c.end_label;
+	if (c.ret) {
+		end->lhs = new_unary(ND_EXPR_STMT, new_var_node(c.ret, tok), tok);
+		add_type(end->lhs->lhs);
+	} else {
+		end->lhs = new_node(ND_BLOCK, tok);
+	}
+	cur = cur->next = end;
+
+	struct Node *expr = new_node(ND_STMT_EXPR, tok);
+	expr->body = head.next;
+	expr->ty = node->ty;
+	return expr;
+}
+
+static void walk(struct Obj *fn, struct Node **np);
+
+static void walk_list(struct Obj *fn, struct Node **np)
+{
+	for (; *np; np = &(*np)->next)
+		walk(fn, np);
+}
+
+static void walk(struct Obj *fn, struct Node **np)
+{
+	struct Node *node = *np;
+
+	if (!node)
+		return;
+
+	walk(fn, &node->lhs);
+	walk(fn, &node->rhs);
+	walk(fn, &node->cond);
+	walk(fn, &node->then);
+	walk(fn, &node->els);
+	walk(fn, &node->init);
+	walk(fn, &node->inc);
+	walk(fn, &node->cas_addr);
+	walk(fn, &node->cas_old);
+	walk(fn, &node->cas_new);
+	walk(fn, &node->atomic_expr);
+	walk_list(fn, &node->body);
+	walk_list(fn, &node->args);
+
+	if (node->kind != ND_FUNCALL)
+		return;
+
+	struct Obj *callee = get_callee(node);
+	if (!callee || !can_inline(node, callee))
+		return;
+
+	struct Node *new = inline_call(fn, node, callee);
+
+	// Calls in the copy may be inlined in turn.
+	stack[depth++] = callee;
+	walk_list(fn, &new->body);
+	depth--;
+
+	new->next = node->next;
+	*np = new;
+}
+
+void inline_functions(struct Obj *prog)
+{
+	for (struct Obj *fn = prog; fn; fn = fn->next) {
+		if (!fn->is_function || !fn->is_definition)
+			continue;
+
+		stack[0] = fn;
+		depth = 1;
+		walk(fn, &fn->body);
+	}
+}
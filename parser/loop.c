@@ -0,0 +1,494 @@
+#include <parser.h>
+#include <type.h>
+#include <hashmap.h>
+
+// Loop optimizations.
+//
+// In a "for" loop that is only entered from the top, two kinds of
+// expressions are moved into new locals that are set up after the
+// loop's init, which mem2reg then keeps in registers:
+//
+//  - Array indexing by the induction variable, `base + i * size`, is
+//    strength-reduced to a pointer that the loop's increment advances
+//    along with i.
+//  - The address of a variable costs an lla, a GOT load or an add to
+//    fp each time it is computed. It is computed once instead.
+
+#define MAX_TEMPS 4	// new locals per loop
+
+static struct Obj *current;
+static struct HashMap addr_taken;	// locals whose address is taken
+static struct HashMap gotos;		// number of gotos to each label
+static bool has_label_val;
+
+struct Loop {
+	struct Node *node;
+	struct HashMap assigned;	// number of assignments to each local
+	struct HashMap gotos;		// gotos from inside the loop
+	struct StringArray labels;	// labels defined in the loop
+	bool has_entry;			// a case label of an outer switch
+
+	struct Obj *iv;			// induction variable
+	int64_t step;
+
+	int nr_temps;
+	struct Obj *temps[MAX_TEMPS];
+	struct Node *inits[MAX_TEMPS];	// the expressions they stand for
+	struct Obj *vars[MAX_TEMPS];	// the variables they are based on
+	int64_t steps[MAX_TEMPS];	// how far a pointer moves, 0 if fixed
+};
+
+static const char *key(void *ptr)
+{
+	return format("%p", ptr);
+}
+
+static int get_count(struct HashMap *map, const char *key)
+{
+	return (intptr_t)hashmap_get(map, key);
+}
+
+static void add_count(struct HashMap *map, const char *key)
+{
+	hashmap_put(map, key, (void *)(intptr_t)(get_count(map, key) + 1));
+}
+
+static void scan_function(struct Node *node)
+{
+	if (!node)
+		return;
+
+	switch (node->kind) {
+	case ND_ADDR:
+		if (node->lhs->kind == ND_VAR)
+			hashmap_put(&addr_taken, key(node->lhs->var), (void *)1);
+		break;
+	case ND_GOTO:
+		add_count(&gotos, node->unique_label);
+		break;
+	case ND_GOTO_EXPR:
+	case ND_LABEL_VAL:
+		has_label_val = true;
+		break;
+	default:
+		break;
+	}
+
+	scan_function(node->lhs);
+	scan_function(node->rhs);
+	scan_function(node->cond);
+	scan_function(node->then);
+	scan_function(node->els);
+	scan_function(node->init);
+	scan_function(node->inc);
+	scan_function(node->cas_addr);
+	scan_function(node->cas_old);
+	scan_function(node->cas_new);
+	scan_function(node->atomic_expr);
+	for (struct Node *n = node->body; n; n = n->next)
+		scan_function(n);
+	for (struct Node *n = node->args; n; n = n->next)
+		scan_function(n);
+}
+
+// `switches` counts the switch statements in the loop around the node.
+static void scan_loop(struct Loop *loop, struct Node *node, int switches)
+{
+	if (!node)
+		return;
+
+	switch (node->kind) {
+	case ND_ASSIGN:
+	case ND_ASSIGN_OP:
+	case ND_POST_INC:
+		if (node->lhs->kind == ND_VAR && node->lhs->var->is_local)
+			add_count(&loop->assigned, key(node->lhs->var));
+		break;
+	case ND_GOTO:
+		add_count(&loop->gotos, node->unique_label);
+		break;
+	case ND_LABEL:
+		strarray_push(&loop->labels, node->unique_label);
+		break;
+	case ND_CASE:
+		if (!switches)
+			loop->has_entry = true;
+		break;
+	case ND_SWITCH:
+		switches++;
+		break;
+	default:
+		break;
+	}
+
+	scan_loop(loop, node->lhs, switches);
+	scan_loop(loop, node->rhs, switches);
+	scan_loop(loop, node->cond, switches);
+	scan_loop(loop, node->then, switches);
+	scan_loop(loop, node->els, switches);
+	scan_loop(loop, node->init, switches);
+	scan_loop(loop, node->inc, switches);
+	scan_loop(loop, node->cas_addr, switches);
+	scan_loop(loop, node->cas_old, switches);
+	scan_loop(loop, node->cas_new, switches);
+	scan_loop(loop, node->atomic_expr, switches);
+	for (struct Node *n = node->body; n; n = n->next)
+		scan_loop(loop, n, switches);
+	for (struct Node *n = node->args; n; n = n->next)
+		scan_loop(loop, n, switches);
+}
+
+// Returns true if control may enter the loop other than from the top,
+// which would skip the code set up before it.
+static bool has_entry(struct Loop *loop)
+{
+	if (loop->has_entry)
+		return true;
+
+	for (int i = 0; i < loop->labels.len; i++) {
+		const char *label = loop->labels.data[i];
+		if (get_count(&gotos, label) != get_count(&loop->gotos, label))
+			return true;
+	}
+	return false;
+}
+
+static bool is_int_const(struct Node *node, int64_t *val)
+{
+	if (node->kind == ND_CAST && is_integer(node->ty))
+		node = node->lhs;
+	if (node->kind != ND_NUM || !is_integer(node->ty))
+		return false;
+	*val = node->val;
+	return true;
+}
+
+// A local which is only read in the loop keeps its value.
+static bool is_fixed(struct Loop *loop, struct Obj *var)
+{
+	return var->is_local && !var->ty->is_volatile && !var->ty->is_atomic &&
+	       !hashmap_get(&addr_taken, key(var)) &&
+	       !get_count(&loop->assigned, key(var));
+}
+
+// Find `i = i + step` in the increment of the loop. i has to be an int
+// or a long which nothing else in the loop assigns to. Unsigned ints
+// are left alone, as they wrap around at 32 bits.
+static void find_iv(struct Loop *loop)
+{
+	struct Node *node = loop->node->inc;
+
+	if (!node)
+		return;
+
+	// The value of i++ is not used.
+	while (node->kind == ND_CAST ||
+	       ((node->kind == ND_ADD || node->kind == ND_SUB) &&
+		node->rhs->kind == ND_NUM))
+		node = node->lhs;
+
+	if (node->kind != ND_ASSIGN || node->lhs->kind != ND_VAR)
+		return;
+
+	struct Obj *var = node->lhs->var;
+	struct Type *ty = var->ty;
+	if (!var->is_local || !is_integer(ty) || ty->kind == TY_BOOL ||
+	    ty->size < 4 || (ty->is_unsigned && ty->size == 4) ||
+	    ty->is_volatile || ty->is_atomic ||
+	    hashmap_get(&addr_taken, key(var)) ||
+	    get_count(&loop->assigned, key(var)) != 1)
+		return;
+
+	struct Node *rhs = node->rhs;
+	if (rhs->kind == ND_CAST && rhs->ty->size == ty->size)
+		rhs = rhs->lhs;
+	if (rhs->kind != ND_ADD && rhs->kind != ND_SUB)
+		return;
+
+	struct Node *lhs = rhs->lhs;
+	if (lhs->kind == ND_CAST && lhs->ty->size >= ty->size &&
+	    is_integer(lhs->ty))
+		lhs = lhs->lhs;
+	if (lhs->kind != ND_VAR || lhs->var != var)
+		return;
+
+	int64_t step;
+	if (!is_int_const(rhs->rhs, &step))
+		return;
+
+	loop->iv = var;
+	loop->step = rhs->kind == ND_ADD ? step : -step;
+}
+
+// Pointer arithmetic converts both operands to the pointer type,
+// which doesn't change any bits.
+static struct Node *skip_casts(struct Node *node)
+{
+	while (node->kind == ND_CAST && node->ty->kind == TY_PTR) {
+		struct Type *ty = node->lhs->ty;
+		if (ty->kind != TY_PTR && ty->kind != TY_ARRAY &&
+		    !(is_integer(ty) && ty->size == 8))
+			break;
+		node = node->lhs;
+	}
+	return node;
+}
+
+// i, or i widened to a long
+static bool is_iv(struct Loop *loop, struct Node *node)
+{
+	if (node->kind == ND_CAST && is_integer(node->ty) && node->ty->size == 8)
+		node = node->lhs;
+	return node->kind == ND_VAR && node->var == loop->iv;
+}
+
+// The address of an array, or a pointer the loop doesn't change
+static struct Obj *fixed_base(struct Loop *loop, struct Node *node)
+{
+	node = skip_casts(node);
+	if (node->kind != ND_VAR)
+		return NULL;
+	if (node->var->ty->kind == TY_ARRAY)
+		return node->var;
+	if (node->var->ty->kind == TY_PTR && is_fixed(loop, node->var))
+		return node->var;
+	return NULL;
+}
+
+// base + i * scale
+static struct Obj *iv_index(struct Loop *loop, struct Node *node,
+			    int64_t *scale)
+{
+	if (node->kind != ND_ADD || node->ty->kind != TY_PTR)
+		return NULL;
+
+	struct Obj *base = fixed_base(loop, node->lhs);
+	if (!base)
+		return NULL;
+
+	struct Node *rhs = skip_casts(node->rhs);
+	if (is_iv(loop, rhs)) {
+		*scale = 1;
+		return base;
+	}
+
+	if (rhs->kind != ND_MUL)
+		return NULL;
+	if (is_iv(loop, rhs->lhs) && is_int_const(rhs->rhs, scale))
+		return base;
+	if (is_iv(loop, rhs->rhs) && is_int_const(rhs->lhs, scale))
+		return base;
+	return NULL;
+}
+
+// Replace the node by a local holding its value, which is set up
+// before the loop. The value is that of `var`, or of its address, or
+// of an index into it, which moves `step` bytes each iteration.
+static void replace(struct Loop *loop, struct Node **np, struct Obj *var,
+		    int64_t step)
+{
+	struct Node *node = *np;
+	int i;
+
+	for (i = 0; i < loop->nr_temps; i++)
+		if (loop->vars[i] == var && loop->steps[i] == step &&
+		    loop->inits[i]->kind == node->kind)
+			break;
+
+	if (i == loop->nr_temps) {
+		if (i == MAX_TEMPS)
+			return;
+
+		struct Type *ty = node->ty;
+		if (ty->kind == TY_ARRAY)
+			ty = pointer_to(ty->base);
+
+		struct Obj *temp = calloc(1, sizeof(struct Obj));
+		temp->name = "";
+		temp->ty = ty;
+		temp->align = ty->align;
+		temp->is_local = true;
+		temp->next = current->locals;
+		current->locals = temp;
+
+		loop->temps[i] = temp;
+		loop->inits[i] = node;
+		loop->vars[i] = var;
+		loop->steps[i] = step;
+		loop->nr_temps++;
+	}
+
+	struct Node *temp = new_var_node(loop->temps[i], node->tok);
+	add_type(temp);
+	temp->next = node->next;
+	*np = temp;
+}
+
+static void reduce(struct Loop *loop, struct Node **np)
+{
+	struct Node *node = *np;
+	struct Obj *base;
+	int64_t scale;
+
+	if (!node)
+		return;
+
+	if (loop->iv && (base = iv_index(loop, node, &scale))) {
+		replace(loop, np, base, scale * loop->step);
+		return;
+	}
+
+	reduce(loop, &node->lhs);
+	reduce(loop, &node->rhs);
+	reduce(loop, &node->cond);
+	reduce(loop, &node->then);
+	reduce(loop, &node->els);
+	reduce(loop, &node->init);
+	reduce(loop, &node->inc);
+	reduce(loop, &node->cas_addr);
+	reduce(loop, &node->cas_old);
+	reduce(loop, &node->cas_new);
+	reduce(loop, &node->atomic_expr);
+	for (struct Node **n = &node->body; *n; n = &(*n)->next)
+		reduce(loop, n);
+	for (struct Node **n = &node->args; *n; n = &(*n)->next)
+		reduce(loop, n);
+}
+
+static void hoist(struct Loop *loop, struct Node **np)
+{
+	struct Node *node = *np;
+
+	if (!node)
+		return;
+
+	if (node->kind == ND_ADDR && node->lhs->kind == ND_VAR &&
+	    node->lhs->var->ty->kind != TY_FUNC &&
+	    node->lhs->var->ty->kind != TY_VLA) {
+		replace(loop, np, node->lhs->var, 0);
+		return;
+	}
+
+	if (node->kind == ND_VAR && node->var->ty->kind == TY_ARRAY) {
+		replace(loop, np, node->var, 0);
+		return;
+	}
+
+	hoist(loop, &node->lhs);
+	hoist(loop, &node->rhs);
+	hoist(loop, &node->cond);
+	hoist(loop, &node->then);
+	hoist(loop, &node->els);
+	hoist(loop, &node->init);
+	hoist(loop, &node->inc);
+	hoist(loop, &node->cas_addr);
+	hoist(loop, &node->cas_old);
+	hoist(loop, &node->cas_new);
+	hoist(loop, &node->atomic_expr);
+	for (struct Node **n = &node->body; *n; n = &(*n)->next)
+		hoist(loop, n);
+	for (struct Node **n = &node->args; *n; n = &(*n)->next)
+		hoist(loop, n);
+}
+
+static struct Node *new_assign(struct Obj *var, struct Node *expr)
+{
+	struct Node *node = new_binary(ND_ASSIGN, new_var_node(var, expr->tok),
+				       expr, expr->tok);
+	add_type(node);
+	return node;
+}
+
+static void optimize_loop(struct Node *node)
+{
+	struct Loop loop = { .node = node };
+
+	scan_loop(&loop, node->cond, 0);
+	scan_loop(&loop, node->then, 0);
+	scan_loop(&loop, node->inc, 0);
+	if (has_entry(&loop))
+		return;
+
+	find_iv(&loop);
+	reduce(&loop, &node->cond);
+	reduce(&loop, &node->then);
+	hoist(&loop, &node->cond);
+	hoist(&loop, &node->then);
+	hoist(&loop, &node->inc);
+
+	if (!loop.nr_temps)
+		return;
+
+	// Set the locals up after the init.
+	struct Node *block = new_node(ND_BLOCK, node->tok);
+	struct Node head = {};
+	struct Node *cur = &head;
+
+	if (node->init)
+		cur = cur->next = node->init;
+
+	for (int i = 0; i < loop.nr_temps; i++) {
+		struct Node *init = loop.inits[i];
+		init->next = NULL;
+		cur = cur->next = new_unary(ND_EXPR_STMT,
+					    new_assign(loop.temps[i], init),
+					    node->tok);
+	}
+	block->body = head.next;
+	node->init = block;
+
+	// Advance the pointers along with i.
+	for (int i = 0; i < loop.nr_temps; i++) {
+		if (!loop.steps[i])
+			continue;
+
+		struct Obj *var = loop.temps[i];
+		struct Node *step = new_ulong(loop.steps[i], node->tok);
+		step->ty = p_ty_long();
+
+		struct Node *add = new_binary(ND_ADD, new_var_node(var, node->tok),
+					      step, node->tok);
+		add_type(add);
+
+		node->inc = new_binary(ND_COMMA, node->inc,
+				       new_assign(var, add), node->tok);
+		add_type(node->inc);
+	}
+}
+
+static void walk(struct Node *node)
+{
+	if (!node)
+		return;
+
+	walk(node->lhs);
+	walk(node->rhs);
+	walk(node->cond);
+	walk(node->then);
+	walk(node->els);
+	walk(node->init);
+	walk(node->inc);
+	for (struct Node *n = node->body; n; n = n->next)
+		walk(n);
+
+	// inner loops first
+	if (node->kind == ND_FOR)
+		optimize_loop(node);
+}
+
+void optimize_loops(struct Obj *prog)
+{
+	for (struct Obj *fn = prog; fn; fn = fn->next) {
+		if (!fn->is_function || !fn->is_definition)
+			continue;
+
+		current = fn;
+		addr_taken = (struct HashMap){};
+		gotos = (struct HashMap){};
+		has_label_val = false;
+
+		scan_function(fn->body);
+		if (!has_label_val)
+			walk(fn->body);
+	}
+}
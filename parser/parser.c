@@ -20,6 +20,15 @@
 // Points to the function object the parser is currently parsing.
 static struct Obj *current_fn;
 
+// alloca() and VLAs keep the bottom of the area they allocate in a
+// local variable, which only the functions using them get.
+void use_alloca(void)
+{
+	if (!current_fn->alloca_bottom)
+		current_fn->alloca_bottom = new_lvar("__alloca_size__",
+						     pointer_to(p_ty_char()));
+}
+
 // funcall = (assign ("," assign)*)? ")"
 static struct Node *funcall(struct Token **rest, struct Token *tok, struct Node *fn)
 {
@@ -76,6 +85,9 @@ static struct Node *funcall(struct Token **rest, struct Token *tok, struct Node
 	if (is_struct_union(node->ty))
 		node->ret_buffer = new_lvar("", node->ty);
 
+	if (fn->kind == ND_VAR && !strcmp(fn->var->name, "alloca"))
+		use_alloca();
+
 	return node;
 }
 
@@ -257,14 +269,6 @@ static struct Node *primary(struct Token **rest, struct Token *tok)
 		struct VarScope *sc = find_var(tok);
 		*rest = tok->next;
 
-		// For "static inline" function
-		if (sc && sc->var && sc->var->is_function) {
-			if (current_fn)
-				strarray_push(&current_fn->refs, sc->var->name);
-			else
-				sc->var->is_root = true;
-		}
-
 		if (sc) {
 			if (sc->var)
 				// variable
@@ -360,12 +364,18 @@ static struct Node *struct_ref(struct Node *node, struct Token *tok)
 	return node;
 }
 
+static bool is_bitfield(struct Node *node)
+{
+	return node->kind == ND_MEMBER && node->member->is_bitfield;
+}
+
 // Convert op= operators to expressions containing an assignment.
 //
-// In general, `A op= C` is converted to ``tmp = &A, *tmp = *tmp op B`.
-// However, if a given expression is of form `A.x op= C`, the input is
-// converted to `tmp = &A, (*tmp).x = (*tmp).x op C` to handle assignments
-// to bitfields.
+// In general, `A op= B` becomes an ND_ASSIGN_OP node whose rhs is
+// `A op B` with an ND_LHS_VAL node in place of A, so that codegen
+// computes the address of A once, loads from it, operates and stores
+// back. A bitfield member is loaded and merged into its storage unit
+// the same way as a plain assignment to it does.
 static struct Node *to_assign(struct Node *binary)
 {
 	add_type(binary->lhs);
@@ -373,36 +383,6 @@ static struct Node *to_assign(struct Node *binary)
 
 	struct Token *tok = binary->tok;
 
-	// Convert `A.x op= C` to `tmp = &A, (*tmp).x = (*tmp).x op C`.
-	if (binary->lhs->kind == ND_MEMBER) {
-		// var tmp
-		struct Obj *var = new_lvar("", pointer_to(binary->lhs->lhs->ty));
-
-		// tmp = &A
-		struct Node *expr1 = new_binary(ND_ASSIGN, new_var_node(var, tok),
-					new_unary(ND_ADDR, binary->lhs->lhs, tok), tok);
-
-		// (*tmp).x
-		struct Node *expr2 = new_unary(ND_MEMBER,
-					new_unary(ND_DEREF, new_var_node(var, tok), tok),
-					tok);
-		expr2->member = binary->lhs->member;
-
-		// the same as expr2
-		struct Node *expr3 = new_unary(ND_MEMBER,
-					new_unary(ND_DEREF, new_var_node(var, tok), tok),
-					tok);
-		expr3->member = binary->lhs->member;
-
-		// expr2 = expr3 op C
-		struct Node *expr4 = new_binary(ND_ASSIGN, expr2,
-					new_binary(binary->kind, expr3, binary->rhs, tok),
-					tok);
-
-		// expr1, expr4
-		return new_binary(ND_COMMA, expr1, expr4, tok);
-	}
-
 	// If A is an atomic type, Convert `A op= B` to
 	// ({
 	//	T1 *addr = &A;
@@ -416,7 +396,7 @@ static struct Node *to_assign(struct Node *binary)
 	//
 	//	new;
 	// })
-	if (binary->lhs->ty->is_atomic) {
+	if (binary->lhs->ty->is_atomic && !is_bitfield(binary->lhs)) {
 		struct Node head = {};
 		struct Node *cur = &head;
 
@@ -481,29 +461,44 @@ static struct Node *to_assign(struct Node *binary)
 		return node;
 	}
 
-	// Convert `A op= C` to `tmp = &A, *tmp = *tmp op B`.
-	// var tmp
-	struct Obj *var = new_lvar("", pointer_to(binary->lhs->ty));
-	// tmp = &A
-	struct Node *expr1 = new_binary(ND_ASSIGN, new_var_node(var, tok),
-					new_unary(ND_ADDR, binary->lhs, tok),
-					tok);
-	// *tmp = *tmp op B
-	struct Node *expr2 = new_binary(ND_ASSIGN,
-					new_unary(ND_DEREF, new_var_node(var, tok), tok),
-					new_binary(binary->kind,
-						   new_unary(ND_DEREF, new_var_node(var, tok), tok),
-						   binary->rhs, tok),
-					tok);
-
-	return new_binary(ND_COMMA, expr1, expr2, tok);
+	// Convert `A op= B` to `A = A op B` if A is a local variable.
+	// Evaluating A twice has no side effect, and A's address is not
+	// taken, so it can still be kept in a register.
+	if (binary->lhs->kind == ND_VAR && binary->lhs->var->is_local)
+		return new_binary(ND_ASSIGN, binary->lhs,
+				  new_binary(binary->kind,
+					     new_var_node(binary->lhs->var, tok),
+					     binary->rhs, tok),
+				  tok);
+
+	// `A op B` reads A through ND_LHS_VAL
+	struct Node *lhs = binary->lhs;
+	struct Node *val = new_node(ND_LHS_VAL, tok);
+	val->ty = lhs->ty;
+	if (lhs->kind == ND_MEMBER)
+		val->member = lhs->member;
+	binary->lhs = val;
+
+	return new_binary(ND_ASSIGN_OP, lhs, binary, tok);
 }
 
-// Convert A++ to `(typeof A)((A += 1) - 1)`
+// Convert A++ to an ND_POST_INC node if A is an integer or a pointer
+// in memory, and to `(typeof A)((A += 1) - 1)` otherwise.
 static struct Node *new_inc_dec(struct Node *node, struct Token *tok, int addend)
 {
 	add_type(node);
 
+	struct Type *ty = node->ty;
+	bool in_memory = node->kind != ND_VAR || !node->var->is_local;
+
+	if (in_memory && !ty->is_atomic && !is_bitfield(node) &&
+	    ((is_integer(ty) && ty->kind != TY_BOOL) ||
+	     (ty->kind == TY_PTR && ty->base->kind != TY_VLA))) {
+		struct Node *inc = new_unary(ND_POST_INC, node, tok);
+		inc->val = ty->kind == TY_PTR ? addend * ty->base->size : addend;
+		return inc;
+	}
+
 	struct Node *node_add = new_add(node, new_num(addend, tok), tok);
 	struct Node *node_to_assign = to_assign(node_add);
 	struct Node *node_minus = new_add(node_to_assign, new_num(-addend, tok), tok);
@@ -1410,6 +1405,8 @@ static void resolve_goto_labels(void)
 		for (struct Node *y = labels; y; y = y->goto_next) {
 			if (!strcmp(x->label, y->label)) {
 				x->unique_label = y->unique_label;
+				if (x->kind == ND_LABEL_VAL)
+					y->is_label_val = true;
 				break;
 			}
 		}
@@ -1422,20 +1419,6 @@ static void resolve_goto_labels(void)
 	gotos = labels = NULL;
 }
 
-static void mark_live(struct Obj *var)
-{
-	if (!var->is_function || var->is_live)
-		return;
-
-	var->is_live = true;
-
-	for (int i = 0; i < var->refs.len; i++) {
-		struct Obj *fn = find_func(var->refs.data[i]);
-		if (fn)
-			mark_live(fn);
-	}
-}
-
 static struct Token *function(struct Token *tok, struct Type *basety,
 			      const struct VarAttr *attr)
 {
@@ -1464,7 +1447,8 @@ static struct Token *function(struct Token *tok, struct Type *basety,
 		fn->is_static = attr->is_static || (attr->is_inline && !attr->is_extern);
 		fn->is_inline = attr->is_inline;
 	}
-	fn->is_root = !(fn->is_static && fn->is_inline);
+	fn->is_always_inline |= attr->is_always_inline;
+	fn->is_noinline |= attr->is_noinline;
 
 	// if it's declaration, return
 	if (consume(&tok, tok, ";"))
@@ -1488,9 +1472,6 @@ static struct Token *function(struct Token *tok, struct Type *basety,
 	if (ty->is_variadic)
 		fn->va_area = new_lvar("__va_area__", array_of(p_ty_char(), 0));
 
-	// define __alloca_size__ variable at alloca_bottom position of stack
-	fn->alloca_bottom = new_lvar("__alloca_size__", pointer_to(p_ty_char()));
-
 	tok = skip(tok, "{");
 
 	// "__func__" is automatically defined as a local variable
@@ -1614,10 +1595,6 @@ struct Obj *parser(struct Token *tok)
 		}
 	}
 
-	for (struct Obj *var = ret_globals(); var; var = var->next)
-		if (var->is_root)
-			mark_live(var);
-
 	// Remove redundant tentative definitions.
 	scan_globals();
 
@@ -35,5 +35,6 @@ struct Node *assign(struct Token **rest, struct Token *tok);
 const char *get_ident(struct Token *tok);
 struct Node *expr(struct Token **rest, struct Token *tok);
 struct Node *conditional(struct Token **rest, struct Token *tok);
+void use_alloca(void);
 
 #endif
@@ -0,0 +1,493 @@
+#include <parser.h>
+#include <type.h>
+#include <hashmap.h>
+
+// Scalar replacement of aggregates.
+//
+// A local struct of up to 16 bytes whose members are all scalars is
+// split into a new local per member if its address is never taken.
+// `x.a` then names a plain variable, which mem2reg may keep in a
+// register, rather than a slot in the frame. When the struct comes
+// back from a call, codegen moves its members from a0 and a1 straight
+// into these variables. Where the struct is used as a whole, e.g.
+// passed to or returned from a function, it is put back together in
+// a temporary, so the variable is only split if its members are read
+// more often than that.
+
+#define MAX_PARTS 16
+
+struct Split {
+	bool escapes;
+	int nr_accesses;	// member reads and stores to the whole
+	int nr_copies;		// reads of the whole
+};
+
+enum Use {
+	ESCAPE,
+	ACCESS,
+	STORE,		// to a member, which pays off if it is read
+	COPY,
+};
+
+static struct Obj *current;
+static struct HashMap splits;	// candidates to split
+
+static const char *key(void *ptr)
+{
+	return format("%p", ptr);
+}
+
+static bool is_scalar_member(struct Member *mem)
+{
+	struct Type *ty = mem->ty;
+
+	if (mem->is_bitfield || ty->is_atomic || ty->is_volatile)
+		return false;
+	if (!is_integer(ty) && !is_float_arg(ty) && ty->kind != TY_PTR)
+		return false;
+	return mem->offset % ty->size == 0;
+}
+
+static bool can_split(struct Obj *var)
+{
+	struct Type *ty = var->ty;
+
+	if (ty->kind != TY_STRUCT || ty->size > 2 * (int)sizeof(long) ||
+	    ty->is_flexible || ty->is_atomic || ty->is_volatile)
+		return false;
+
+	for (struct Obj *param = current->params; param; param = param->next)
+		if (param == var)
+			return false;
+
+	int n = 0;
+	for (struct Member *mem = ty->members; mem; mem = mem->next)
+		if (!is_scalar_member(mem) || ++n > MAX_PARTS)
+			return false;
+	return n;
+}
+
+// Whether ND_MEMZERO clears each member entirely or not at all.
+static bool clears_whole_members(struct Node *node)
+{
+	for (struct Member *mem = node->var->ty->members; mem; mem = mem->next) {
+		long begin = mem->offset;
+		long end = begin + mem->ty->size;
+
+		if (begin < node->end && end > node->begin &&
+		    (begin < node->begin || end > node->end))
+			return false;
+	}
+	return true;
+}
+
+static void scan(struct Node *node);
+
+// Account for `node` being used as `use` if it is a candidate.
+static void scan_use(struct Node *node, enum Use use)
+{
+	if (!node)
+		return;
+
+	struct Split *split = NULL;
+	if (node->kind == ND_VAR)
+		split = hashmap_get(&splits, key(node->var));
+	if (!split) {
+		scan(node);
+		return;
+	}
+
+	if (use == ESCAPE)
+		split->escapes = true;
+	else if (use == ACCESS)
+		split->nr_accesses++;
+	else if (use == COPY)
+		split->nr_copies++;
+}
+
+static void scan(struct Node *node)
+{
+	struct Split *split;
+
+	switch (node->kind) {
+	case ND_ADDR:
+		// &x.a
+		if (node->lhs->kind == ND_MEMBER)
+			scan_use(node->lhs->lhs, ESCAPE);
+		break;
+	case ND_MEMZERO:
+		split = hashmap_get(&splits, key(node->var));
+		if (split && !clears_whole_members(node))
+			split->escapes = true;
+		break;
+	case ND_ASSIGN:
+		if (node->lhs->kind == ND_MEMBER) {
+			scan_use(node->lhs->lhs, STORE);
+			scan_use(node->rhs, COPY);
+			return;
+		}
+		break;
+	case ND_FUNCALL:
+		if (node->ret_buffer) {
+			split = hashmap_get(&splits, key(node->ret_buffer));
+			if (split)
+				split->escapes = true;
+		}
+		break;
+	default:
+		break;
+	}
+
+	enum Use lhs_use = ESCAPE;
+	if (node->kind == ND_MEMBER || node->kind == ND_ASSIGN)
+		lhs_use = ACCESS;
+	else if (node->kind == ND_CAST || node->kind == ND_RETURN)
+		lhs_use = COPY;
+
+	scan_use(node->lhs, lhs_use);
+	scan_use(node->rhs, node->kind == ND_ASSIGN ? COPY : ESCAPE);
+	scan_use(node->cond, ESCAPE);
+	scan_use(node->then, ESCAPE);
+	scan_use(node->els, ESCAPE);
+	scan_use(node->init, ESCAPE);
+	scan_use(node->inc, ESCAPE);
+	scan_use(node->cas_addr, ESCAPE);
+	scan_use(node->cas_old, ESCAPE);
+	scan_use(node->cas_new, ESCAPE);
+	scan_use(node->atomic_expr, ESCAPE);
+	for (struct Node *n = node->body; n; n = n->next)
+		scan_use(n, ESCAPE);
+	for (struct Node *n = node->args; n; n = n->next)
+		scan_use(n, COPY);
+}
+
+static struct Obj *new_local(struct Type *ty)
+{
+	struct Obj *var = calloc(1, sizeof(struct Obj));
+	var->name = "";
+	var->ty = ty;
+	var->align = ty->align;
+	var->is_local = true;
+	var->next = current->locals;
+	current->locals = var;
+	return var;
+}
+
+static void split_var(struct Obj *var)
+{
+	int n = 0;
+	for (struct Member *mem = var->ty->members; mem; mem = mem->next)
+		n++;
+
+	var->parts = calloc(n, sizeof(struct Obj *));
+	n = 0;
+	for (struct Member *mem = var->ty->members; mem; mem = mem->next)
+		var->parts[n++] = new_local(mem->ty);
+}
+
+static bool is_split(struct Node *node)
+{
+	return node->kind == ND_VAR && node->var->parts;
+}
+
+static struct Obj *part_of(struct Obj *var, struct Member *member)
+{
+	int i = 0;
+	for (struct Member *mem = var->ty->members; mem; mem = mem->next, i++)
+		if (mem->offset == member->offset)
+			return var->parts[i];
+	unreachable();
+}
+
+static struct Node *new_part(struct Obj *part, struct Token *tok)
+{
+	struct Node *node = new_var_node(part, tok);
+	add_type(node);
+	return node;
+}
+
+static struct Node *new_member(struct Node *lhs, struct Member *mem,
+			       struct Token *tok)
+{
+	struct Node *node = new_unary(ND_MEMBER, lhs, tok);
+	node->member = mem;
+	add_type(node);
+	return node;
+}
+
+static struct Node *new_assign(struct Node *lhs, struct Node *rhs,
+			       struct Token *tok)
+{
+	struct Node *node = new_binary(ND_ASSIGN, lhs, rhs, tok);
+	add_type(node);
+	return node;
+}
+
+// `lhs, rhs`, or just `rhs` if there is no lhs.
+static struct Node *new_comma(struct Node *lhs, struct Node *rhs,
+			      struct Token *tok)
+{
+	if (!lhs)
+		return rhs;
+
+	struct Node *node = new_binary(ND_COMMA, lhs, rhs, tok);
+	add_type(node);
+	return node;
+}
+
+// Put the struct back together: `(tmp.a = a, tmp.b = b, tmp)`.
+static struct Node *join(struct Obj *var, struct Token *tok)
+{
+	struct Obj *tmp = new_local(var->ty);
+	struct Node *node = NULL;
+	int i = 0;
+
+	for (struct Member *mem = var->ty->members; mem; mem = mem->next, i++)
+		node = new_comma(node,
+				 new_assign(new_member(new_part(tmp, tok), mem, tok),
+					    new_part(var->parts[i], tok), tok),
+				 tok);
+	return new_comma(node, new_part(tmp, tok), tok);
+}
+
+static struct Node *zero_parts(struct Node *node)
+{
+	struct Obj *var = node->var;
+	struct Node *res = NULL;
+	int i = 0;
+
+	for (struct Member *mem = var->ty->members; mem; mem = mem->next, i++) {
+		if (mem->offset < node->begin || mem->offset >= node->end)
+			continue;
+
+		struct Node *zero = new_num(0, node->tok);
+		zero->ty = mem->ty;
+		res = new_comma(res,
+				new_assign(new_part(var->parts[i], node->tok), zero,
+					   node->tok),
+				node->tok);
+	}
+	return res ? res : new_node(ND_NULL_EXPR, node->tok);
+}
+
+// A variable, or a member of or what a variable points to, which
+// reads the same each time and has no side effect.
+static bool is_plain_lvalue(struct Node *node)
+{
+	if (node->ty->is_volatile)
+		return false;
+
+	switch (node->kind) {
+	case ND_VAR:
+		return !node->var->parts;
+	case ND_DEREF:
+		return node->lhs->kind == ND_VAR && !node->lhs->var->parts &&
+		       !node->lhs->ty->is_volatile;
+	case ND_MEMBER:
+		return is_plain_lvalue(node->lhs);
+	default:
+		return false;
+	}
+}
+
+static struct Node *copy_lvalue(struct Node *node)
+{
+	struct Node *copy = calloc(1, sizeof(struct Node));
+	*copy = *node;
+	copy->next = NULL;
+	if (node->lhs)
+		copy->lhs = copy_lvalue(node->lhs);
+	return copy;
+}
+
+static void rewrite(struct Node **np, bool discard);
+
+// `x = E` where x is split.
+static struct Node *split_assign(struct Node *node, bool discard)
+{
+	struct Obj *var = node->lhs->var;
+	struct Node *rhs = node->rhs;
+	struct Token *tok = node->tok;
+	struct Node *res = NULL;
+	int i = 0;
+
+	if (rhs->kind == ND_FUNCALL && rhs->ret_buffer &&
+	    rhs->ty->members == var->ty->members) {
+		// The members are moved from a0 and a1 to the parts.
+		rewrite(&rhs, false);
+		rhs->ret_buffer = new_local(var->ty);
+		rhs->ret_buffer->parts = var->parts;
+		res = rhs;
+	} else if (is_split(rhs)) {
+		for (struct Member *mem = var->ty->members; mem; mem = mem->next, i++)
+			res = new_comma(res,
+					new_assign(new_part(var->parts[i], tok),
+						   new_part(rhs->var->parts[i], tok),
+						   tok),
+					tok);
+	} else if (is_plain_lvalue(rhs) && rhs->ty->members == var->ty->members) {
+		for (struct Member *mem = var->ty->members; mem; mem = mem->next, i++)
+			res = new_comma(res,
+					new_assign(new_part(var->parts[i], tok),
+						   new_member(copy_lvalue(rhs), mem, tok),
+						   tok),
+					tok);
+	} else {
+		// `tmp = E, a = tmp.a, b = tmp.b`
+		struct Obj *tmp = new_local(var->ty);
+
+		rewrite(&rhs, false);
+		res = new_assign(new_part(tmp, tok), rhs, tok);
+		for (struct Member *mem = var->ty->members; mem; mem = mem->next, i++)
+			res = new_comma(res,
+					new_assign(new_part(var->parts[i], tok),
+						   new_member(new_part(tmp, tok), mem, tok),
+						   tok),
+					tok);
+	}
+
+	if (!discard)
+		res = new_comma(res, join(var, tok), tok);
+	return res;
+}
+
+// `x.a op= B` becomes `a = a op B`.
+static void split_assign_op(struct Node *node, struct Obj *part)
+{
+	for (struct Node *n = node->rhs; n && n->kind != ND_ASSIGN_OP; n = n->lhs) {
+		if (n->kind == ND_LHS_VAL) {
+			n->kind = ND_VAR;
+			n->var = part;
+			n->member = NULL;
+			break;
+		}
+	}
+
+	node->kind = ND_ASSIGN;
+	node->lhs = new_part(part, node->tok);
+}
+
+// `x.a++` becomes `(typeof a)((a = a + val) - val)`.
+static struct Node *split_post_inc(struct Node *node, struct Obj *part)
+{
+	struct Token *tok = node->tok;
+	struct Type *ty = part->ty;
+	struct Type *step_ty = ty->kind == TY_PTR || ty->size == sizeof(long) ?
+			       p_ty_long() : p_ty_int();
+
+	struct Node *step = new_num(node->val, tok);
+	step->ty = step_ty;
+	struct Node *add = new_binary(ND_ADD, new_part(part, tok), step, tok);
+	struct Node *assign = new_assign(new_part(part, tok), add, tok);
+
+	step = new_num(node->val, tok);
+	step->ty = step_ty;
+	return new_cast(new_binary(ND_SUB, assign, step, tok), ty);
+}
+
+static void replace(struct Node **np, struct Node *node)
+{
+	node->next = (*np)->next;
+	*np = node;
+}
+
+// `discard` tells whether the value of the node is unused.
+static void rewrite(struct Node **np, bool discard)
+{
+	struct Node *node = *np;
+	if (!node)
+		return;
+
+	switch (node->kind) {
+	case ND_VAR:
+		if (node->var->parts)
+			replace(np, join(node->var, node->tok));
+		return;
+	case ND_MEMBER:
+		if (is_split(node->lhs)) {
+			replace(np, new_part(part_of(node->lhs->var, node->member),
+					     node->tok));
+			return;
+		}
+		break;
+	case ND_MEMZERO:
+		if (node->var->parts)
+			replace(np, zero_parts(node));
+		return;
+	case ND_ASSIGN:
+		if (is_split(node->lhs)) {
+			replace(np, split_assign(node, discard));
+			return;
+		}
+		break;
+	case ND_ASSIGN_OP:
+		if (node->lhs->kind == ND_MEMBER && is_split(node->lhs->lhs))
+			split_assign_op(node, part_of(node->lhs->lhs->var,
+						      node->lhs->member));
+		break;
+	case ND_POST_INC:
+		if (node->lhs->kind == ND_MEMBER && is_split(node->lhs->lhs)) {
+			replace(np, split_post_inc(node, part_of(node->lhs->lhs->var,
+								 node->lhs->member)));
+			return;
+		}
+		break;
+	default:
+		break;
+	}
+
+	rewrite(&node->lhs, node->kind == ND_EXPR_STMT || node->kind == ND_COMMA);
+	rewrite(&node->rhs, node->kind == ND_COMMA && discard);
+	rewrite(&node->cond, false);
+	rewrite(&node->then, node->kind == ND_COND && discard);
+	rewrite(&node->els, node->kind == ND_COND && discard);
+	rewrite(&node->init, false);
+	rewrite(&node->inc, node->kind == ND_FOR);
+	rewrite(&node->cas_addr, false);
+	rewrite(&node->cas_old, false);
+	rewrite(&node->cas_new, false);
+	rewrite(&node->atomic_expr, false);
+	for (struct Node **p = &node->body; *p; p = &(*p)->next) {
+		// The last statement of ({ ... }) gives its value.
+		if (node->kind == ND_STMT_EXPR && !(*p)->next &&
+		    (*p)->kind == ND_EXPR_STMT)
+			rewrite(&(*p)->lhs, false);
+		else
+			rewrite(p, true);
+	}
+	for (struct Node **p = &node->args; *p; p = &(*p)->next)
+		rewrite(p, false);
+}
+
+void split_aggregates(struct Obj *prog)
+{
+	for (struct Obj *fn = prog; fn; fn = fn->next) {
+		if (!fn->is_function || !fn->is_definition)
+			continue;
+
+		current = fn;
+		splits = (struct HashMap){};
+
+		for (struct Obj *var = fn->locals; var; var = var->next)
+			if (can_split(var))
+				hashmap_put(&splits, key(var),
+					    calloc(1, sizeof(struct Split)));
+		if (!splits.used)
+			continue;
+
+		scan(fn->body);
+
+		bool changed = false;
+		for (struct Obj *var = fn->locals; var; var = var->next) {
+			struct Split *split = hashmap_get(&splits, key(var));
+			if (split && !split->escapes &&
+			    split->nr_accesses > split->nr_copies) {
+				split_var(var);
+				changed = true;
+			}
+		}
+
+		if (changed)
+			rewrite(&fn->body, true);
+	}
+}
@@ -0,0 +1,92 @@
+#include <toycc.h>
+
+// Pass manager.
+//
+// Each pass is enabled from an optimization level on: -O0 only runs
+// the peephole optimizer, the inlining of always_inline functions and
+// the removal of unused static inline functions, -O1 the cheap passes
+// and -O2 all of them.
+// The program passes run on the AST between parser() and codegen(),
+// the IR passes run on each function once codegen() has lowered it.
+
+struct Pass {
+	const char *name;
+	int level;		// lowest -O level the pass runs at
+	void (*run)(struct Obj *prog);
+};
+
+struct IRPass {
+	const char *name;
+	int level;
+	void (*run)(struct IRFunc *ir);
+};
+
+static void mark_reachable(struct BasicBlock *bb)
+{
+	while (bb && !bb->is_reachable) {
+		bb->is_reachable = true;
+		mark_reachable(bb->succ[1]);
+		bb = bb->succ[0];
+	}
+}
+
+// Remove the blocks control can never reach, such as the code
+// following a return statement.
+static void remove_unreachable(struct IRFunc *ir)
+{
+	ir_build_cfg(ir);
+
+	// Give up if a branch goes somewhere we don't know of.
+	for (struct BasicBlock *bb = ir->blocks; bb; bb = bb->next)
+		for (struct Insn *insn = bb->head; insn; insn = insn->next) {
+			if (insn->kind == IR_ASM ||
+			    (ir_branch_target(insn) && !bb->succ[0]))
+				return;
+			if (insn == bb->tail)
+				break;
+		}
+
+	// Labels whose address is taken may be jumped to indirectly.
+	mark_reachable(ir->blocks);
+	for (struct BasicBlock *bb = ir->blocks; bb; bb = bb->next)
+		if (bb->head->is_addr_taken)
+			mark_reachable(bb);
+
+	for (struct BasicBlock *bb = ir->blocks; bb; bb = bb->next) {
+		if (bb->is_reachable)
+			continue;
+
+		struct Insn *end = bb->tail->next;
+		for (struct Insn *insn = bb->head; insn != end; insn = insn->next)
+			ir_delete(ir, insn);
+	}
+}
+
+static const struct Pass passes[] = {
+	{ "inline", 0, inline_functions },
+	{ "fold", 1, fold_constants },
+	{ "loop", 2, optimize_loops },
+	{ "dead", 0, remove_dead_globals },
+	{ "sra", 1, split_aggregates },
+	{ "mem2reg", 1, promote_lvars },
+};
+
+static const struct IRPass ir_passes[] = {
+	{ "unreachable", 1, remove_unreachable },
+	{ "peephole", 0, peephole },
+	{ "cse", 1, eliminate_common_subexprs },
+};
+
+void optimize(struct Obj *prog)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(passes); i++)
+		if (get_opt_O() >= passes[i].level)
+			passes[i].run(prog);
+}
+
+void optimize_ir(struct IRFunc *ir)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(ir_passes); i++)
+		if (get_opt_O() >= ir_passes[i].level)
+			ir_passes[i].run(ir);
+}
@@ -0,0 +1,629 @@
+#include <toycc.h>
+
+// Peephole optimizer.
+//
+// codegen() emits code for one node at a time, which leaves patterns
+// such as values pushed to the stack only to be popped right back,
+// jumps to the very next instruction, or moves that only shuffle a
+// value from the register it was computed in to the one it is used
+// from, and casts extend values that already are extended, or whose
+// upper bits are never read anyway. These are rewritten until nothing
+// changes anymore.
+
+static bool is_float(int reg)
+{
+	return reg >= 32;
+}
+
+// Whether `opnd` is the integer immediate `val`.
+static bool is_imm(const char *opnd, long val)
+{
+	char *end;
+	long n = strtol(opnd, &end, 0);
+	return end != opnd && !*end && n == val;
+}
+
+static bool is_addi(struct Insn *insn, const char *rd, const char *rs, long imm)
+{
+	return (ir_is(insn, "addi") || ir_is(insn, "add")) &&
+	       !strcmp(insn->opnds[0], rd) && !strcmp(insn->opnds[1], rs) &&
+	       is_imm(insn->opnds[2], imm);
+}
+
+// Turn `insn` into a move from `src` to `dst`.
+static void make_move(struct Insn *insn, int dst, int src)
+{
+	if (is_float(dst))
+		insn->op = is_float(src) ? "fmv.d" : "fmv.d.x";
+	else
+		insn->op = is_float(src) ? "fmv.x.d" : "mv";
+
+	insn->opnds[0] = ir_reg_name(dst);
+	insn->opnds[1] = ir_reg_name(src);
+	insn->nr_opnds = 2;
+}
+
+// Returns the register copied by a move to another register of the
+// same kind, or -1.
+static int move_src(struct Insn *insn)
+{
+	if (!ir_is(insn, "mv") && !ir_is(insn, "fmv.d"))
+		return -1;
+	return ir_reg(insn->opnds[1]);
+}
+
+// The instruction before `insn` in the same basic block, if any.
+static struct Insn *prev_in_block(struct Insn *insn)
+{
+	struct Insn *prev = ir_prev(insn);
+
+	if (!prev || prev->kind != IR_INSN || ir_is_cond_branch(prev) ||
+	    ir_is_jump(prev))
+		return NULL;
+	return prev;
+}
+
+// j L
+// L:
+static bool remove_jump_to_next(struct IRFunc *ir, struct Insn *insn)
+{
+	if (!ir_is(insn, "j"))
+		return false;
+
+	// a numeric label "Nf" refers to the next "N"
+	const char *target = insn->opnds[0];
+	size_t len = strlen(target);
+	if (len > 1 && target[len - 1] == 'f' && isdigit(*target))
+		target = strndup(target, len - 1);
+
+	for (struct Insn *p = insn->next; p && p->kind != IR_INSN &&
+	     p->kind != IR_ASM; p = p->next) {
+		if (p->kind == IR_LABEL && !strcmp(p->op, target)) {
+			ir_delete(ir, insn);
+			return true;
+		}
+	}
+	return false;
+}
+
+// mv x, x
+// addi x, x, 0
+static bool remove_nop(struct IRFunc *ir, struct Insn *insn)
+{
+	int src = move_src(insn);
+
+	if ((src >= 0 && src == ir_reg(insn->opnds[0])) ||
+	    is_addi(insn, insn->opnds[0], insn->opnds[0], 0)) {
+		ir_delete(ir, insn);
+		return true;
+	}
+	return false;
+}
+
+// addi sp, sp, -8        mv y, x
+// sd x, 0(sp)
+// ...                    ...
+// ld y, 0(sp)
+// addi sp, sp, 8
+//
+// if the code in between neither touches sp nor changes x.
+static bool fold_push_pop(struct IRFunc *ir, struct Insn *insn)
+{
+	if (!is_addi(insn, "sp", "sp", -8))
+		return false;
+
+	struct Insn *push = ir_next(insn);
+	if ((!ir_is(push, "sd") && !ir_is(push, "fsd")) ||
+	    strcmp(push->opnds[1], "0(sp)"))
+		return false;
+
+	int src = ir_reg(push->opnds[0]);
+	if (src <= 0)
+		return false;
+
+	for (struct Insn *p = ir_next(push); p; p = ir_next(p)) {
+		if (p->kind != IR_INSN || ir_is_call(p) ||
+		    ir_is_cond_branch(p) || ir_is_jump(p))
+			return false;
+
+		if ((ir_is(p, "ld") || ir_is(p, "fld")) &&
+		    !strcmp(p->opnds[1], "0(sp)")) {
+			struct Insn *pop = ir_next(p);
+			if (!is_addi(pop, "sp", "sp", 8))
+				return false;
+
+			make_move(p, ir_reg(p->opnds[0]), src);
+			ir_delete(ir, insn);
+			ir_delete(ir, push);
+			ir_delete(ir, pop);
+			return true;
+		}
+
+		if ((ir_uses(p) | ir_defs(p)) & IR_REG(IR_SP))
+			return false;
+		if (ir_defs(p) & IR_REG(src))
+			return false;
+	}
+	return false;
+}
+
+// How the value written to a register is extended to 64 bits:
+// from `bits` bits, sign-extended if `is_signed`.
+struct Ext {
+	int bits;
+	bool is_signed;
+};
+
+static struct Ext produced_ext(struct Insn *insn)
+{
+	static const char * const sext32[] = {
+		"addw", "addiw", "subw", "negw", "mulw", "divw", "divuw",
+		"remw", "remuw", "sllw", "slliw", "srlw", "srliw", "sraw",
+		"sraiw", "sext.w", "lw", "fmv.x.w",
+		"fcvt.w.s", "fcvt.w.d", "fcvt.wu.s", "fcvt.wu.d",
+	};
+	static const char * const bool_ops[] = {
+		"slt", "sltu", "slti", "sltiu", "seqz", "snez", "sltz",
+		"sgtz", "feq.s", "feq.d", "flt.s", "flt.d", "fle.s", "fle.d",
+	};
+	const char *op = insn->op;
+
+	for (size_t i = 0; i < ARRAY_SIZE(sext32); i++)
+		if (!strcmp(op, sext32[i]))
+			return (struct Ext){32, true};
+
+	for (size_t i = 0; i < ARRAY_SIZE(bool_ops); i++)
+		if (!strcmp(op, bool_ops[i]))
+			return (struct Ext){1, false};
+
+	if (!strcmp(op, "lb"))
+		return (struct Ext){8, true};
+	if (!strcmp(op, "lh"))
+		return (struct Ext){16, true};
+	if (!strcmp(op, "lbu"))
+		return (struct Ext){8, false};
+	if (!strcmp(op, "lhu"))
+		return (struct Ext){16, false};
+	if (!strcmp(op, "lwu"))
+		return (struct Ext){32, false};
+
+	// the second half of an extension
+	if ((!strcmp(op, "srai") || !strcmp(op, "srli")) &&
+	    insn->nr_opnds == 3) {
+		int shift = strtol(insn->opnds[2], NULL, 10);
+		if (shift > 0 && shift < 64)
+			return (struct Ext){64 - shift, op[2] == 'a'};
+	}
+
+	if (!strcmp(op, "li") && insn->nr_opnds == 2) {
+		char *end;
+		long val = strtol(insn->opnds[1], &end, 0);
+		if (*end)
+			return (struct Ext){64, true};
+
+		for (int bits = 1; bits < 64; bits++) {
+			if (val >= 0 && val < (1L << bits))
+				return (struct Ext){bits, false};
+			if (val >= -(1L << (bits - 1)) && val < (1L << (bits - 1)))
+				return (struct Ext){bits, true};
+		}
+	}
+
+	return (struct Ext){64, true};
+}
+
+// Whether extending a value extended as `have` as `want` is a no-op.
+static bool is_extended(struct Ext have, struct Ext want)
+{
+	if (want.is_signed)
+		return have.bits < want.bits ||
+		       (have.is_signed && have.bits == want.bits);
+	return !have.is_signed && have.bits <= want.bits;
+}
+
+// Parse an extension of `*src` into `*dst`: either sext.w or a pair of
+// shifts. Returns the last instruction of it.
+static struct Insn *parse_ext(struct Insn *insn, struct Ext *ext,
+			      int *dst, int *src)
+{
+	if (ir_is(insn, "sext.w")) {
+		*ext = (struct Ext){32, true};
+		*dst = ir_reg(insn->opnds[0]);
+		*src = ir_reg(insn->opnds[1]);
+		return insn;
+	}
+
+	if (!ir_is(insn, "slli"))
+		return NULL;
+
+	struct Insn *next = ir_next(insn);
+	if (!ir_is(next, "srai") && !ir_is(next, "srli"))
+		return NULL;
+
+	// slli d, s, k
+	// sr[al]i d, d, k
+	const char *d = insn->opnds[0];
+	if (strcmp(next->opnds[0], d) || strcmp(next->opnds[1], d) ||
+	    strcmp(next->opnds[2], insn->opnds[2]))
+		return NULL;
+
+	int shift = strtol(insn->opnds[2], NULL, 10);
+	if (shift <= 0 || shift >= 64)
+		return NULL;
+
+	*ext = (struct Ext){64 - shift, next->op[2] == 'a'};
+	*dst = ir_reg(d);
+	*src = ir_reg(insn->opnds[1]);
+	return next;
+}
+
+#define NO_EXT ((struct Ext){64, true})
+
+// The extension of a value computed bitwise from ones extended as `a`
+// and `b`.
+static struct Ext join_ext(struct Ext a, struct Ext b)
+{
+	// a zero-extended value is also sign-extended from one bit more
+	if (a.is_signed != b.is_signed) {
+		if (!a.is_signed)
+			a = (struct Ext){MIN(a.bits + 1, 64), true};
+		if (!b.is_signed)
+			b = (struct Ext){MIN(b.bits + 1, 64), true};
+	}
+	return (struct Ext){MAX(a.bits, b.bits), a.is_signed};
+}
+
+// The extension of the value `insn` writes to its first operand,
+// knowing those of the registers it reads.
+static struct Ext ext_after(struct Insn *insn, struct Ext *exts)
+{
+	int a = insn->nr_opnds > 1 ? ir_reg(insn->opnds[1]) : -1;
+	int b = insn->nr_opnds > 2 ? ir_reg(insn->opnds[2]) : -1;
+
+	if (ir_is(insn, "mv") && a >= 0)
+		return exts[a];
+
+	if (ir_is(insn, "andi") && a >= 0) {
+		long imm = strtol(insn->opnds[2], NULL, 0);
+		if (imm >= 0)
+			return (struct Ext){MAX(bit_width(imm), 1), false};
+	}
+
+	if ((ir_is(insn, "and") || ir_is(insn, "or") || ir_is(insn, "xor")) &&
+	    a >= 0 && b >= 0) {
+		struct Ext ext = join_ext(exts[a], exts[b]);
+
+		// masking with a zero-extended value clears the rest
+		if (ir_is(insn, "and") && !exts[a].is_signed)
+			ext = exts[a];
+		if (ir_is(insn, "and") && !exts[b].is_signed &&
+		    (ext.is_signed || exts[b].bits < ext.bits))
+			ext = exts[b];
+		return ext;
+	}
+
+	return produced_ext(insn);
+}
+
+// Whether `opnd` is a memory operand based on register `reg`.
+static bool is_based_on(const char *opnd, int reg)
+{
+	const char *paren = strchr(opnd, '(');
+	return paren && !strcmp(paren, format("(%s)", ir_reg_name(reg)));
+}
+
+// How many low bits of register `reg` `insn` reads, 64 for all of
+// them. A narrow store or an instruction computing a 32-bit result
+// ignores the rest.
+static int read_bits(struct Insn *insn, int reg)
+{
+	static const char * const word_ops[] = {
+		"addw", "addiw", "subw", "negw", "mulw", "divw", "divuw",
+		"remw", "remuw", "sllw", "srlw", "srliw", "sraw", "sraiw",
+		"sext.w", "fmv.w.x",
+		"fcvt.s.w", "fcvt.d.w", "fcvt.s.wu", "fcvt.d.wu",
+	};
+
+	if (!(ir_uses(insn) & IR_REG(reg)))
+		return 0;
+	if (ir_is_call(insn))
+		return 64;
+
+	if (ir_is(insn, "sb") || ir_is(insn, "sh") || ir_is(insn, "sw")) {
+		if (is_based_on(insn->opnds[1], reg))
+			return 64;
+		return insn->op[1] == 'b' ? 8 : insn->op[1] == 'h' ? 16 : 32;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(word_ops); i++)
+		if (ir_is(insn, word_ops[i]))
+			return 32;
+
+	// the bits shifted out are never read
+	if ((ir_is(insn, "slli") || ir_is(insn, "slliw")) &&
+	    insn->nr_opnds == 3) {
+		int width = insn->op[4] == 'w' ? 32 : 64;
+		int shift = strtol(insn->opnds[2], NULL, 10);
+		if (shift >= 0 && shift < width)
+			return width - shift;
+	}
+
+	if (ir_is(insn, "andi") && ir_reg(insn->opnds[1]) == reg) {
+		long imm = strtol(insn->opnds[2], NULL, 0);
+		if (imm >= 0)
+			return bit_width(imm);
+	}
+	return 64;
+}
+
+// Whether any of the bits beyond the low `bits` of register `reg` is
+// read after `insn` before the register is written to once more.
+static bool reads_high_bits(struct BasicBlock *bb, struct Insn *insn,
+			    int reg, int bits)
+{
+	struct Insn *end = bb->tail->next;
+
+	for (struct Insn *p = insn->next; p != end; p = p->next) {
+		if (p->kind == IR_DIRECTIVE)
+			continue;
+		if (p->kind != IR_INSN || read_bits(p, reg) > bits)
+			return true;
+		if (ir_defs(p) & IR_REG(reg))
+			return false;
+	}
+	return bb->live_out & IR_REG(reg);
+}
+
+// Track how every register of a basic block is extended, and turn
+// extensions into moves where they change no bit that is ever read:
+//
+// lw a0, 0(a0)                       lw a0, 0(a0)
+// sext.w a1, a0      mv a1, a0
+//
+// slli a0, a0, 56    mv a0, a0       (removed as a no-op)
+// srai a0, a0, 56    mv a0, a0
+// sb a0, 0(a1)                       sb a0, 0(a1)
+static bool remove_extensions(struct BasicBlock *bb)
+{
+	struct Ext exts[IR_NR_REGS];
+	struct Insn *end = bb->tail->next;
+	bool changed = false;
+
+	for (int i = 0; i < IR_NR_REGS; i++)
+		exts[i] = NO_EXT;
+	exts[0] = (struct Ext){1, false};
+
+	for (struct Insn *insn = bb->head; insn != end; insn = insn->next) {
+		if (insn->kind == IR_DIRECTIVE || insn->kind == IR_LABEL)
+			continue;
+
+		if (insn->kind != IR_INSN) {
+			for (int i = 1; i < IR_NR_REGS; i++)
+				exts[i] = NO_EXT;
+			continue;
+		}
+
+		struct Ext ext;
+		int dst, src;
+		struct Insn *last = parse_ext(insn, &ext, &dst, &src);
+		if (last && dst > 0 && src >= 0 && dst < 32 && src < 32 &&
+		    (is_extended(exts[src], ext) ||
+		     !reads_high_bits(bb, last, dst, ext.bits))) {
+			make_move(insn, dst, src);
+			if (last != insn)
+				make_move(last, dst, dst);
+			changed = true;
+		}
+
+		struct Ext after = ext_after(insn, exts);
+		uint64_t defs = ir_defs(insn);
+
+		// calls clobber all the caller-saved registers
+		if (ir_is_call(insn))
+			defs |= ~IR_CALLEE_SAVED_REGS;
+
+		for (int i = 1; i < IR_NR_REGS; i++)
+			if (defs & IR_REG(i))
+				exts[i] = NO_EXT;
+
+		int rd = insn->nr_opnds ? ir_reg(insn->opnds[0]) : -1;
+		if (rd > 0 && (defs & IR_REG(rd)))
+			exts[rd] = after;
+	}
+	return changed;
+}
+
+static bool rewrite_windows(struct IRFunc *ir)
+{
+	bool changed = false;
+
+	for (struct Insn *insn = ir->head, *next; insn; insn = next) {
+		next = insn->next;
+
+		if (insn->kind != IR_INSN)
+			continue;
+
+		// Rewrites only delete instructions from `insn` on, so
+		// start over from the one before, which may begin a new
+		// window now.
+		struct Insn *prev = insn->prev;
+
+		if (remove_jump_to_next(ir, insn) || remove_nop(ir, insn) ||
+		    fold_push_pop(ir, insn)) {
+			changed = true;
+			next = prev ? prev : ir->head;
+		}
+	}
+	return changed;
+}
+
+// op a, ...        op b, ...
+// mv b, a
+//
+// if a is dead afterwards.
+static bool rename_def(struct Insn *prev, struct Insn *insn, uint64_t live)
+{
+	int src = move_src(insn);
+	if (src < 0)
+		return false;
+
+	int dst = ir_reg(insn->opnds[0]);
+	if (dst < 0 || src == dst || (IR_REG(src) & (live | IR_FIXED_REGS)))
+		return false;
+
+	if (ir_defs(prev) != IR_REG(src) || ir_reg(prev->opnds[0]) != src ||
+	    (ir_has_side_effects(prev) && !ir_is_load(prev)))
+		return false;
+
+	prev->opnds[0] = ir_reg_name(dst);
+	return true;
+}
+
+// Replace the uses of register `from` in the operands of `insn`.
+// Returns false, leaving `insn` alone, if some of them can't be.
+static bool replace_uses(struct Insn *insn, int from, int to)
+{
+	struct Insn new = *insn;
+	const char *name = ir_reg_name(from);
+	size_t n = strlen(name);
+
+	for (int i = ir_defs(insn) && !ir_is_store(insn) ? 1 : 0;
+	     i < insn->nr_opnds; i++) {
+		const char *opnd = insn->opnds[i];
+		size_t len = strlen(opnd);
+
+		if (!strcmp(opnd, name))
+			new.opnds[i] = ir_reg_name(to);
+		else if (len >= n + 2 && opnd[len - 1] == ')' &&
+			 opnd[len - n - 2] == '(' &&
+			 !strncmp(opnd + len - n - 1, name, n))
+			new.opnds[i] = format("%.*s(%s)", (int)(len - n - 2),
+					      opnd, ir_reg_name(to));
+	}
+
+	if (ir_uses(&new) & IR_REG(from))
+		return false;
+
+	memcpy(insn->opnds, new.opnds, sizeof(new.opnds));
+	return true;
+}
+
+// mv a, b
+// op ..., a        op ..., b
+//
+// if a is dead afterwards, or redefined by op itself.
+static bool forward_copy(struct Insn *prev, struct Insn *insn, uint64_t live)
+{
+	int src = move_src(prev);
+	if (src < 0)
+		return false;
+
+	int dst = ir_reg(prev->opnds[0]);
+	if (dst < 0 || src == dst || (IR_REG(dst) & IR_FIXED_REGS))
+		return false;
+
+	// Calls read the argument registers implicitly.
+	if (insn->kind != IR_INSN || ir_is_call(insn) || ir_is_jump(insn) ||
+	    !(ir_uses(insn) & IR_REG(dst)))
+		return false;
+
+	if ((live & IR_REG(dst)) && !(ir_defs(insn) & IR_REG(dst)))
+		return false;
+
+	return replace_uses(insn, dst, src);
+}
+
+// lla a, sym
+// lw b, 8(a)       lw b, sym+8
+// sw b, 8(a)       sw b, sym+8, a
+//
+// if a is dead afterwards. The assembler computes the address with
+// auipc in b itself for integer loads, in a otherwise.
+static bool fold_symbol(struct Insn *prev, struct Insn *insn, uint64_t live)
+{
+	if (!ir_is(prev, "lla") || insn->nr_opnds != 2 ||
+	    (!ir_is_load(insn) && !ir_is_store(insn)))
+		return false;
+
+	int a = ir_reg(prev->opnds[0]);
+	int b = ir_reg(insn->opnds[0]);
+	const char *mem = insn->opnds[1];
+	const char *paren = strchr(mem, '(');
+	char *end;
+	long off = strtol(mem, &end, 0);
+
+	if (!paren || end != paren ||
+	    strcmp(paren, format("(%s)", ir_reg_name(a))) ||
+	    (ir_is_store(insn) && b == a) ||
+	    ((live & IR_REG(a)) && (b != a || ir_is_store(insn))))
+		return false;
+
+	if (off)
+		insn->opnds[1] = format("%s%+ld", prev->opnds[1], off);
+	else
+		insn->opnds[1] = prev->opnds[1];
+
+	if (ir_is_store(insn) || is_float(b))
+		insn->opnds[insn->nr_opnds++] = prev->opnds[0];
+	return true;
+}
+
+// Rewrite a basic block backward, knowing the registers live at
+// each point.
+static bool rewrite_block(struct IRFunc *ir, struct BasicBlock *bb)
+{
+	struct Insn *end = bb->head->prev;
+	uint64_t live = bb->live_out;
+	bool changed = false;
+
+	for (struct Insn *insn = bb->tail; insn != end;) {
+		struct Insn *prev = insn->prev;
+
+		if (insn->kind == IR_INSN) {
+			if (ir_is_dead(insn, live)) {
+				ir_delete(ir, insn);
+				changed = true;
+				insn = prev;
+				continue;
+			}
+
+			struct Insn *p = prev_in_block(insn);
+			if (p && p != end && rename_def(p, insn, live)) {
+				ir_delete(ir, insn);
+				changed = true;
+				insn = p;
+				continue;
+			}
+
+			if (p && p != end && fold_symbol(p, insn, live)) {
+				ir_delete(ir, p);
+				changed = true;
+				prev = insn->prev;
+			}
+
+			if (p && p != end && forward_copy(p, insn, live)) {
+				ir_delete(ir, p);
+				changed = true;
+				prev = insn->prev;
+			}
+		}
+
+		live = ir_live_before(insn, live);
+		insn = prev;
+	}
+	return changed;
+}
+
+void peephole(struct IRFunc *ir)
+{
+	for (bool changed = true; changed;) {
+		changed = rewrite_windows(ir);
+
+		ir_build_cfg(ir);
+		ir_liveness(ir);
+		for (struct BasicBlock *bb = ir->blocks; bb; bb = bb->next) {
+			changed |= remove_extensions(bb);
+			changed |= rewrite_block(ir, bb);
+		}
+	}
+}
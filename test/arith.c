@@ -64,6 +64,23 @@ int main()
 	ASSERT(2, ({ int a[3]; a[0]=0; a[1]=1; a[2]=2; int *p=a+1; (*p++)--; a[2]; }));
 	ASSERT(2, ({ int a[3]; a[0]=0; a[1]=1; a[2]=2; int *p=a+1; (*p++)--; *p; }));
 
+	ASSERT(10, ({ int a[2]={3,4}; int *p=a; p[1]+=6; }));
+	ASSERT(9, ({ int a[2]={1,2}; a[0]+=(a[1]*=4); }));
+	ASSERT(8, ({ int a[2]={1,2}; a[0]+=(a[1]*=4); a[1]; }));
+	ASSERT(127, ({ char c[1]={127}; c[0]++; }));
+	ASSERT(-128, ({ char c[1]={127}; c[0]++; c[0]; }));
+	ASSERT(255, ({ unsigned char c[1]={0}; --c[0]; }));
+	ASSERT(65535, ({ unsigned short s[1]={0}; s[0]--; s[0]; }));
+	ASSERT(8, ({ long a[2]; long *q[1]={a}; q[0]++; (char *)q[0]-(char *)a; }));
+	ASSERT(1, ({ struct { char x[4096]; } *q[1]={0}; q[0]++; (long)q[0]>>12; }));
+	ASSERT(5, ({ float f[1]={2.5}; f[0]*=2; }));
+	ASSERT(2, ({ double d[1]={2.5}; d[0]++; }));
+	ASSERT(3, ({ double d[1]={2.5}; d[0]++; d[0]; }));
+	ASSERT(4, ({ long double d[1]={1.5}; d[0]+=2.5; d[0]; }));
+	ASSERT(7, ({ struct { int a:3, b:4; } x={1,5}; x.b+=2; }));
+	ASSERT(1, ({ struct { int a:3, b:4; } x={1,5}; x.b+=2; x.a; }));
+	ASSERT(-4, ({ struct { int a:3; } x={3}; x.a++; x.a; }));
+
 	ASSERT(0, !1);
 	ASSERT(0, !2);
 	ASSERT(1, !0);
@@ -139,6 +156,44 @@ int main()
 	ASSERT(5, (long double)3+2);
 	ASSERT(6, (long double)3*2);
 	ASSERT(5, (long double)3+2.0);
+	ASSERT(4, ({ int c=1; long double x=3; (int)(c ? x+1 : x*2); }));
+	ASSERT(6, ({ int c=0; long double x=3; (int)(c ? x+1 : x*2); }));
+
+	ASSERT(-2047, ({ int x=1; x-2048; }));
+	ASSERT(2049, ({ long x=1; x+2048; }));
+	ASSERT(-2, ({ int x=2147483647; x+2147483647; }));
+	ASSERT(5, ({ unsigned char x=0xf5; x&15; }));
+	ASSERT(-1, ({ int x=-16; x|15; }));
+	ASSERT(0, ({ long x=-2048; x^-2048; }));
+	ASSERT(-8, ({ int x=-1; x<<3; }));
+	ASSERT(-1, ({ int x=-1; x>>31; }));
+	ASSERT(1, ({ unsigned x=-1; x>>31; }));
+	ASSERT(1, ({ unsigned long x=-1; x>>63; }));
+	ASSERT(40, ({ long x=5; 8*x; }));
+	ASSERT(1, ({ int x=7; x==7; }));
+	ASSERT(0, ({ int x=7; x!=7; }));
+	ASSERT(1, ({ int x=-1; x<0; }));
+	ASSERT(0, ({ unsigned x=-1; x<10; }));
+	ASSERT(1, ({ unsigned long x=5; x<=5; }));
+	ASSERT(1, ({ unsigned long x=-1; x<=-1; }));
+	ASSERT(1, ({ long x=-3; x<=-3; }));
+	ASSERT(3, ({ int a[4]={0,1,2,3}; int *p=a; *(p+3); }));
+
+	ASSERT(-3, ({ int x=-7; x/2; }));
+	ASSERT(-1, ({ int x=-7; x%2; }));
+	ASSERT(3, ({ int x=-7; x/-2; }));
+	ASSERT(-7, ({ int x=-7; x%16; }));
+	ASSERT(-214748364, ({ int x=-2147483647; x/10; }));
+	ASSERT(-7, ({ int x=-2147483647; x%10; }));
+	ASSERT(429496729, ({ unsigned x=-1; x/10; }));
+	ASSERT(5, ({ unsigned x=-1; x%10; }));
+	ASSERT(4, ({ unsigned x=-1; x%7 + x/0x7fffffff; }) - 1);
+	ASSERT(-3, ({ long x=-1000000000000; x/333333333333; }));
+	ASSERT(-1, ({ long x=-1000000000000; x%333333333333; }));
+	ASSERT(1, ({ unsigned long x=-1; x/7 == 2635249153387078802; }));
+	ASSERT(1, ({ unsigned long x=-1; x%7; }));
+	ASSERT(1, ({ unsigned long x=-1; x/10 == 1844674407370955161; }));
+	ASSERT(255, ({ unsigned long x=-1; x%4096/16; }));
 
 	pass();
 	return 0;
@@ -1,6 +1,10 @@
 #include "test.h"
 #include "stddef.h"
 
+static __attribute__((always_inline)) int always_fn(int x) { return x * 2; }
+__attribute__((noinline)) int never_fn(int x) { return x * 3; }
+static inline __attribute__((always_inline, noinline)) int both_fn(int x) { return x * 4; }
+
 int main()
 {
 	ASSERT(5, ({
@@ -48,6 +52,10 @@ int main()
 
 	ASSERT(16, ({ struct __attribute__((aligned(8+8))) { char a; int b; } x; _Alignof(x); }));
 
+	ASSERT(6, always_fn(3));
+	ASSERT(9, never_fn(3));
+	ASSERT(12, both_fn(3));
+
 	pass();
 	return 0;
 }
@@ -1,5 +1,8 @@
 #include "test.h"
 
+char to_char(int x) { return x; }
+unsigned short to_ushort(long x) { return x; }
+
 int main()
 {
 	ASSERT(131585, (int)8590066177);
@@ -66,6 +69,22 @@ int main()
 	ASSERT(3, (float)3L);
 	ASSERT(3, (double)3L);
 
+	ASSERT(255, ({ signed char x=-1; (unsigned char)x; }));
+	ASSERT(-128, ({ short x=128; (signed char)x; }));
+	ASSERT(65535, ({ short x=-1; (unsigned short)x; }));
+	ASSERT(-1, ({ unsigned x=4294967295U; (long)(int)x; }));
+	ASSERT(1, ({ int x=-1; (unsigned)x > 0; }));
+
+	ASSERT(-2, to_char(254));
+	ASSERT(65535, to_ushort(-1));
+	ASSERT(1, ({ char c=to_char(511); c == -1; }));
+	ASSERT(3, ({ char b[2]; int x=259; b[0]=x; b[1]=x; b[0]+b[1]-3; }));
+	ASSERT(-126, ({ char b[2]; long x=130; b[0]=x; b[1]=0; b[0]; }));
+	ASSERT(858993459, ({ long y=-1; unsigned x=y; x/5; }));
+	ASSERT(0, ({ long x=0x100000000L; (int)x; }));
+	ASSERT(-1, ({ long x=0xffffffffL; int y=(int)x; switch (y) { case -1: break; default: y=0; } y; }));
+	ASSERT(1, ({ int a=1, b=2; char c=(char)(a<b); c; }));
+
 	pass();
 	return 0;
 }
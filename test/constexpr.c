@@ -51,6 +51,27 @@ int main()
 	ASSERT(1, ({ char x[(unsigned)1<=-1]; sizeof(x); }));
 	ASSERT(0, ({ char x[(unsigned)1>-1]; sizeof(x); }));
 
+	ASSERT(-2147483648, 2147483647+1);
+	ASSERT(1, (unsigned)-1>>31);
+	ASSERT(-1, -1>>31);
+	ASSERT(-3, -7/2);
+	ASSERT(-1, -7%2);
+	ASSERT(1, 0.1f+0.2f == (float)0.3);
+	ASSERT(0, 0.1+0.2 == 0.3);
+	ASSERT(0, 1.1f == 1.1);
+	ASSERT(1000000014, (long)((0.1f+0.0)*1e10));
+	ASSERT(1100000023, (long)((double)1.1f*1e9));
+	ASSERT(0, ({ int x=0; if (1e-50f) x=1; x; }));
+	ASSERT(3, (int)3.9);
+	ASSERT(1, (_Bool)256);
+	ASSERT(1, (_Bool)0.5);
+	ASSERT(255, (unsigned char)-1);
+	ASSERT(5, ({ int x=5; x*1+0; }));
+	ASSERT(5, ({ int x=5; (x&-1)|0; }));
+	ASSERT(6, ({ int x=5; x++ + 0; x; }));
+	ASSERT(0, ({ int x=0; 0 && x++; x; }));
+	ASSERT(7, ({ int x[4]={4,5,6,7}; *(x+3); }));
+
 	ASSERT(1, g40==1.5);
 	ASSERT(1, g41==11);
 
@@ -4,6 +4,112 @@
  * This is a block comment.
  */
 
+static int dense_switch(int x)
+{
+	switch (x) {
+	case -2: return 10;
+	case 0: return 11;
+	case 1: return 12;
+	case 2: return 13;
+	case 4 ... 6: return 14;
+	case 7: return 15;
+	default: return 16;
+	}
+}
+
+static int sparse_switch(long x)
+{
+	switch (x) {
+	case -1000: return 1;
+	case 3: return 2;
+	case 100: return 3;
+	case 1000 ... 1010: return 4;
+	case 5000: return 5;
+	case 70000: return 6;
+	case 1 << 30: return 7;
+	}
+	return 0;
+}
+
+static int unsigned_switch(unsigned x)
+{
+	int i = 0;
+
+	switch (x) {
+	case 0xffffffff: i++;
+	case 1: i++;
+	case 2: i++;
+	case 3: i++;
+	case 4: i++;
+	case 5: break;
+	}
+	return i;
+}
+
+static int loop_arr[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+static long sum_ptr(int *p, int n)
+{
+	long s = 0;
+	for (int i = 0; i < n; i++)
+		s += p[i];
+	return s;
+}
+
+static long sum_down(long *p, long n)
+{
+	long s = 0;
+	for (long i = n - 1; i >= 0; i -= 2)
+		s += p[i];
+	return s;
+}
+
+static int sum_skip(int n)
+{
+	int s = 0;
+	for (int i = 0; i < n; i++) {
+		if (loop_arr[i] % 3 == 0)
+			continue;
+		s += loop_arr[i];
+	}
+	return s;
+}
+
+static int sum_2d(int n)
+{
+	int a[3][4], s = 0;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 4; j++)
+			a[i][j] = i * n + j;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 4; j++)
+			s += a[i][j] * (i + 1);
+	return s;
+}
+
+static int loop_goto(int n)
+{
+	int s = 0, i = 2;
+	goto in;
+	for (i = 0; i < n; i++) {
+in:
+		s += loop_arr[i];
+	}
+	return s;
+}
+
+static int loop_case(int x)
+{
+	int s = 0, i = 0;
+	switch (x) {
+		for (i = 0; i < 4; i++) {
+	case 1:
+			s += loop_arr[i];
+		}
+	}
+	return s * 100 + i;
+}
+
 int main()
 {
 	ASSERT(3, ({ int x; if (0) x=2; else x=3; x; }));
@@ -97,6 +203,60 @@ int main()
 	ASSERT(2, ({ static void *p[]={ &&v52, &&v52, &&v53 }; int i=0; goto *p[1]; v51:i++; v52:i++; v53:i++; i; }));
 	ASSERT(1, ({ static void *p[]={ &&v62, &&v62, &&v63 }; int i=0; goto *p[2]; v61:i++; v62:i++; v63:i++; i; }));
 
+	ASSERT(2, ({ int i=0; if (1) i=2; else i=3; i; }));
+	ASSERT(3, ({ int i=0; if (0) i=2; else i=3; i; }));
+	ASSERT(2, ({ int i=0; goto l1; if (0) { l1: i=2; } i; }));
+	ASSERT(5, ({ int i=0; switch (1) { if (0) { case 1: i=5; } } i; }));
+	ASSERT(3, ({ int i=0; for (;1;) if (++i==3) break; i; }));
+
+	ASSERT(10, dense_switch(-2));
+	ASSERT(16, dense_switch(-1));
+	ASSERT(11, dense_switch(0));
+	ASSERT(13, dense_switch(2));
+	ASSERT(16, dense_switch(3));
+	ASSERT(14, dense_switch(5));
+	ASSERT(15, dense_switch(7));
+	ASSERT(16, dense_switch(8));
+	ASSERT(16, dense_switch(-2147483647-1));
+	ASSERT(1, sparse_switch(-1000));
+	ASSERT(2, sparse_switch(3));
+	ASSERT(0, sparse_switch(4));
+	ASSERT(3, sparse_switch(100));
+	ASSERT(4, sparse_switch(1005));
+	ASSERT(0, sparse_switch(1011));
+	ASSERT(5, sparse_switch(5000));
+	ASSERT(6, sparse_switch(70000));
+	ASSERT(7, sparse_switch(1 << 30));
+	ASSERT(0, sparse_switch(1L << 32));
+	ASSERT(5, unsigned_switch(-1));
+	ASSERT(2, unsigned_switch(3));
+	ASSERT(0, unsigned_switch(5));
+	ASSERT(0, unsigned_switch(6));
+
+	ASSERT(0, ({ unsigned long x=-1; x<=1; }));
+	ASSERT(2, ({ unsigned long x=-1; x<=1 ? 1 : 2; }));
+	ASSERT(1, ({ int x=-1; x<=1 ? 1 : 2; }));
+	ASSERT(1, ({ unsigned x=3; int r=0; if (x>=3 && !(x==4) || x<0) r=1; r; }));
+	ASSERT(0, ({ int x=2; double d=0.0; x && d; }));
+	ASSERT(1, ({ int x=0; double d=0.5; x || d; }));
+	ASSERT(10, ({ int i=0, j=0; while (i<10 && !(j>20)) { i++; j+=2; } i; }));
+	ASSERT(5, ({ int i=0; do i++; while (i!=5 || 0); i; }));
+	ASSERT(3, ({ long i=0; char *p="abc"; while (p[i] && i<=5) i++; i; }));
+
+	ASSERT(55, sum_ptr(loop_arr, 10));
+	ASSERT(0, sum_ptr(loop_arr, 0));
+	ASSERT(12, ({ long a[]={1,2,3,4,5,6}; sum_down(a, 6); }));
+	ASSERT(9, ({ long a[]={1,2,3,4,5}; sum_down(a, 5); }));
+	ASSERT(37, sum_skip(10));
+	ASSERT(196, sum_2d(5));
+	ASSERT(52, loop_goto(10));
+	ASSERT(0, loop_case(0));
+	ASSERT(1004, loop_case(1));
+	ASSERT(15, ({ char s[]="abcde"; int n=0; for (int i=0; i<5; i++) n+=s[i]-'a'+1; n; }));
+	ASSERT(6, ({ int a[4]={0}; int i; for (i=0; i<4; i++) a[i]=i; a[1]+a[2]+a[3]; }));
+	ASSERT(4, ({ int x=0, *p=&x; for (int i=0; i<4; i++) *p+=1; x; }));
+	ASSERT(20, ({ short a[5]={2,4,6,8}; int s=0; for (int i=0; i<5; i++) { s+=a[i]; if (i==3) break; } s; }));
+
 	pass();
 	return 0;
 }
@@ -41,6 +41,59 @@ check --help
 echo 'int main() {}' | $cc -c -S -o - -xc - | grep -q 'main:'
 check -S
 
+# -O
+echo 'int main() { return 0; }' | $cc -c -S -O2 -o - -xc - | grep -q 'main:'
+check -O2
+echo 'int main() {}' | $cc -c -S -Ox -o /dev/null -xc - 2>&1 | grep -q 'invalid optimization level'
+check -Ox
+
+# volatile structs stay in memory
+echo 'int f(void) { volatile struct { int a, b; } x; x.a = 1; x.b = 2; return x.a + x.b; }' | \
+	$cc -c -S -O2 -o - -xc - | grep -c '^\s*sw ' | grep -q '^2$'
+check 'volatile struct'
+
+# members of a volatile struct are loaded each time they are read
+echo 'struct R { int a; int stat; }; int f(volatile struct R *r) { int a = r->stat; int b = r->stat; return a + b; }' | \
+	$cc -c -S -O2 -o - -xc - | grep -c '^\s*lw .*, 4(' | grep -q '^2$'
+check 'volatile struct member'
+echo 'typedef struct { int a; int stat; } RR; int f(volatile RR *r) { int a = r->stat; int b = r->stat; return a + b; }' | \
+	$cc -c -S -O2 -o - -xc - | grep -c '^\s*lw .*, 4(' | grep -q '^2$'
+check 'volatile struct member'
+
+# variables of functions that make no calls take caller-saved registers
+echo 'int f(int *p, int n) { int s = 0; for (int i = 0; i < n; i++) s += p[i]; return s; }' | \
+	$cc -c -S -O2 -o - -xc - | grep -q '^\s*sd s\([2-9]\|1[01]\),'
+[ $? -ne 0 ]
+check 'caller-saved register variables'
+
+# leaf functions with parameters set up no frame
+echo 'int get(int *p) { return p[3]; }' | \
+	$cc -c -S -O2 -o - -xc - | grep -q 'sd fp,\|mv fp, sp'
+[ $? -ne 0 ]
+check 'leaf without frame'
+echo 'int add(int a, int b) { return a + b; }' | \
+	$cc -c -S -O2 -o - -xc - | grep -q '(fp)\|(sp)'
+[ $? -ne 0 ]
+check 'leaf without frame'
+echo 'int second(int a, int b) { return b; }' | \
+	$cc -c -S -O2 -o - -xc - | grep -q '(fp)\|(sp)'
+[ $? -ne 0 ]
+check 'leaf without frame'
+
+# callee-saved registers are saved relative to sp without a frame
+echo 'int g(int); int h(int x) { return g(x) + g(x + 1); }' | \
+	$cc -c -S -O2 -o - -xc - | grep -q 'mv fp, sp'
+[ $? -ne 0 ]
+check 'callee-saved registers without frame'
+
+# a mostly zero array is cleared with one aligned memset
+echo 'void g(char *); void f(void) { char v[4096] = {0}; g(v); }' | \
+	$cc -c -S -O2 -o - -xc - > $tmp/memset.s
+grep -c '^\s*call memset$' $tmp/memset.s | grep -q '^1$' && \
+	grep -q '^\s*li a2, 4096$' $tmp/memset.s && \
+	! grep -q '^\s*sb ' $tmp/memset.s
+check 'zero initializer'
+
 # Default output file
 rm -f $tmp/out.o $tmp/out.s
 echo 'int main() {}' > $tmp/out.c
@@ -70,6 +70,34 @@ _Bool bool_fn_sub(_Bool x) { return x - 1; }
 
 static int static_fn(void) { return 3; }
 
+static inline int inl_sq(int x) { return x * x; }
+static int inl_clamp(int x) { if (x < 0) return 0; if (x > 9) return 9; return x; }
+static int inl_case(int x) { switch (x) { case 1: return 10; case 2: x = 20; break; default: return -1; } return x + 1; }
+static int inl_sum(int n) { int s = 0; for (int i = 0; i < n; i++) { if (i == 5) continue; s += i; } return s; }
+static void inl_set(int *p, int v) { *p = v; }
+static int inl_inc(int *p) { return ++*p; }
+static int inl_count(void) { static int n; return ++n; }
+static int inl_param(int x) { int *p = &x; *p += 1; return x; }
+static int inl_fact(int n) { return n <= 1 ? 1 : n * inl_fact(n - 1); }
+static __attribute__((always_inline)) long inl_always(long x) { return x + 1; }
+__attribute__((noinline)) static int inl_never(int x) { return x + 2; }
+
+static int live_value = 11;
+static int live_target(void) { return live_value; }
+static int (*live_ptr)(void) = live_target;
+static int dead_target(void) { return live_target() + 1; }
+
+long tail_sum(long n, long acc) { if (n == 0) return acc; return tail_sum(n - 1, acc + n); }
+int tail_odd(unsigned n);
+int tail_even(unsigned n) { return n == 0 ? 1 : tail_odd(n - 1); }
+int tail_odd(unsigned n) { if (n == 0) return 0; return tail_even(n - 1); }
+int tail_sub(int a, int b) { return a - b; }
+int tail_swap(int a, int b) { return tail_sub(b, a); }
+int tail_ptr(int (*fn)(int, int), int a, int b) { return fn(a, b); }
+double tail_fsub(double a, double b) { return a - b; }
+double tail_fswap(double a, double b, int c) { return tail_fsub(b + c, a); }
+int tail_addr(int x) { int *p = &x; return tail_sub(*p, 1); }
+
 int param_decay(int x[]) { return x[0]; }
 
 int counter() {
@@ -152,6 +180,15 @@ int many_args4(int a, int b, int c, int d, int e, int f, int g, int h, int i, in
 	return i / j;
 }
 
+int sum_range(int a, int b, int c, int d, int e, int f, int g, int h,
+	      char lo, unsigned short hi)
+{
+	int sum = 0;
+	for (; lo < hi; lo++)
+		sum += lo;
+	return sum;
+}
+
 double many_args2(double a, double b, double c, double d, double e,
                   double f, double g, double h, double i, double j)
 {
@@ -410,6 +447,11 @@ long double to_ldouble(int x)
 	return x;
 }
 
+double mix_args(int a, double b, long c, float d, char e, double f)
+{
+	return a * 100000 + b * 10000 + c * 1000 + d * 100 + e * 10 + f;
+}
+
 int main()
 {
 	ASSERT(3, ret3());
@@ -522,6 +564,7 @@ int main()
 	ASSERT(8, many_args3(1,2,3,4,5,6,7,8,9,10,11,12,13,14,80,10));
 
 	ASSERT(3, many_args4(1,2,3,4,5,6,40,10,60,20));
+	ASSERT(4950, sum_range(1,2,3,4,5,6,7,8,0,100));
 	ASSERT(10, many_args5(1,2,3,4,5,6,7,8,9,10,11,12,13,14,80,10,90,9));
 
 	ASSERT(10, ({ Ty4 x={10,20,30,40}; struct_test4(x, 0); }));
@@ -900,6 +943,47 @@ int main()
 
 	ASSERT(1, to_ldouble(5.0) == 5.0);
 	ASSERT(0, to_ldouble(5.0) == 5.2);
+	ASSERT(7, (int)({ long double x=3; x + to_ldouble(4); }));
+	ASSERT(1, ({ long double x=2; x * to_ldouble(3) - to_ldouble(5) == 1; }));
+
+	ASSERT(20, ({ int x=1; x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+x; }));
+	ASSERT(62, add2(1,2)+add2(1,2)*add2(1,2)+add2(add2(1,2),add2(3,4))*add2(1,4));
+	ASSERT(36, ({ int x=1; x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+add2(x,x)*add2(add2(x,x),add2(x,x))+x+x+x+x+x+x+x+x+x+x+x; }));
+	ASSERT(123456, ({ int a=1; double b=2; long c=3; float d=4; char e=5; mix_args(a, b, c, d, e, 6); }));
+	ASSERT(654321, ({ int a=6; double f=1; char *p="\2"; mix_args(a, add_double3(1,2,2), add2(1,3), 3, *p, f); }));
+	ASSERT(9, ({ int x=4, *p=&x; add2(*p, add2(x, 1)); }));
+	ASSERT(21, ({ int x=1; long y=2; add6(x, y, add2(x, 2), 4, (char)261, 6+x-x); }));
+
+	ASSERT(49, inl_sq(7));
+	ASSERT(30, inl_sq(3) + inl_sq(inl_sq(1) + 2) + inl_sq(-2) * 3);
+	ASSERT(0, inl_clamp(-5));
+	ASSERT(4, inl_clamp(4));
+	ASSERT(9, inl_clamp(100));
+	ASSERT(10, inl_case(1));
+	ASSERT(21, inl_case(2));
+	ASSERT(-1, inl_case(3));
+	ASSERT(31, inl_case(1) + inl_case(2));
+	ASSERT(40, inl_sum(10));
+	ASSERT(5, ({ int x=0; inl_set(&x, 5); x; }));
+	ASSERT(3, ({ int x=1; inl_inc(&x); inl_inc(&x); }));
+	ASSERT(3, ({ inl_count(); inl_count(); inl_count(); }));
+	ASSERT(4, ({ int x=3; inl_param(x); }));
+	ASSERT(3, ({ int x=3; inl_param(x); x; }));
+	ASSERT(120, inl_fact(5));
+	ASSERT(6, inl_always(5));
+	ASSERT(7, inl_never(5));
+	ASSERT(11, live_ptr());
+
+	ASSERT(50005000, tail_sum(10000, 0));
+	ASSERT(1, tail_even(10000));
+	ASSERT(0, tail_odd(10000));
+	ASSERT(3, tail_swap(2, 5));
+	ASSERT(-3, tail_ptr(tail_sub, 2, 5));
+	ASSERT(3, tail_ptr(tail_swap, 2, 5));
+	ASSERT(9, tail_fswap(1, 7, 3));
+	ASSERT(6, tail_addr(7));
+
+	ASSERT(54, ({ int s=0; for (int i=0; i<10; i++) s += inl_clamp(i) + inl_sq(0); s + inl_clamp(10); }));
 
 	pass();
 }
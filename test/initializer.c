@@ -267,6 +267,18 @@ int main()
 	ASSERT(16, ({ char x[]={[2 ... 10]='a', [7]='b', [15 ... 15]='c', [3 ... 5]='d'}; sizeof(x); }));
 	ASSERT(0, ({ char x[]={[2 ... 10]='a', [7]='b', [15 ... 15]='c', [3 ... 5]='d'}; memcmp(x, "\0\0adddabaaa\0\0\0\0c", 16); }));
 
+	ASSERT(0, ({ char x[4096]={1}; x[4095]+x[2048]+x[1]; }));
+	ASSERT(1, ({ char x[4096]={1}; x[0]; }));
+	ASSERT(6, ({ char c=1; char x[203]={[3]=5}; c+x[3]+x[0]+x[202]+x[100]; }));
+	ASSERT(0, ({ char c=1; short x[100]={[99]=0}; long s=0; for (int i=0; i<100; i++) s+=x[i]; s; }));
+	ASSERT(9, ({ struct {char a; long b; char c[5];} x={1,8}; x.a+x.b+x.c[4]; }));
+	ASSERT(7, ({ struct {int a:3; int b:5; char c;} x={3,4}; x.a+x.b+x.c; }));
+	ASSERT(6, ({ int x[3]={1,2,3}; x[0]+x[1]+x[2]; }));
+	ASSERT(0, ({ char big[5000]={}; int s=0; for (int i=0; i<5000; i++) s+=big[i]; s; }));
+	ASSERT(3, ({ char x[4096]={0, 0, 3}; x[0]+x[1]+x[2]+x[4095]; }));
+	ASSERT(0, ({ char s[64]="ab"; memcmp(s, "ab\0\0", 4)+s[63]; }));
+	ASSERT(1, ({ struct { int a; double d; long l[20]; } x={0, -0.0, {0, 5}}; 1/x.d<0 && x.l[1]==5 && !x.a; }));
+
 	pass();
 	return 0;
 }
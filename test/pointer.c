@@ -1,5 +1,26 @@
 #include "test.h"
 
+struct Node3 { struct Node3 *next; int val; };
+
+static int bump(int *p)
+{
+	return ++*p;
+}
+
+static int reload_chain(struct Node3 *n, int *p)
+{
+	int a = n->next->next->val;
+	*p = 10;
+	return a + n->next->next->val;
+}
+
+static long reload_call(int *p)
+{
+	long a = *p;
+	bump(p);
+	return a * 10 + *p;
+}
+
 int main()
 {
 	ASSERT(3, ({ int x=3; *&x; }));
@@ -40,6 +61,15 @@ int main()
 	ASSERT(4, ({ int x[2][3]; int *y=x; y[4]=4; x[1][1]; }));
 	ASSERT(5, ({ int x[2][3]; int *y=x; y[5]=5; x[1][2]; }));
 
+	ASSERT(6, ({ struct Node3 c={0,3}, b={&c,2}, a={&b,1}; int r=reload_chain(&a, &a.val); r+a.val-10; }));
+	ASSERT(13, ({ struct Node3 c={0,3}, b={&c,2}, a={&b,1}; reload_chain(&a, &c.val); }));
+	ASSERT(56, ({ int x=5; reload_call(&x); }));
+	ASSERT(12, ({ int x[2]={3,4}; int *p=x, *q=x; int a=*p; *(q+1)=9; a+*p+*(p+1)-3; }));
+	ASSERT(3, ({ int x[2]={3,4}; char *q=(char *)x; int a=x[0]; q[0]=0; a; }));
+	ASSERT(0, ({ int x[2]={3,4}; char *q=(char *)x; x[0]; q[0]=0; x[0]; }));
+	ASSERT(-4294967296L, ({ long l=-1; int *p=(int *)&l; l; *p=0; l; }));
+	ASSERT(2, ({ volatile int v=1; int a=v; v=2; v; }));
+
 	pass();
 	return 0;
 }
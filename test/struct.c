@@ -1,5 +1,14 @@
 #include "test.h"
 
+typedef struct { char c; short s; int i; long l; } SraInt;
+typedef struct { float f; int i; double d; } SraFloat;
+typedef struct { int *p; int n; } SraPtr;
+
+static SraInt sra_int(int x) { SraInt s = {x, x*2, x*3, x*4}; return s; }
+static SraFloat sra_float(float f, double d) { SraFloat s; s.f=f; s.i=7; s.d=d; return s; }
+static long sra_sum(SraInt s) { return s.c + s.s + s.i + s.l; }
+static SraInt sra_twice(int x) { SraInt s = sra_int(x); s.i *= 2; s.l = s.l + s.i; return s; }
+
 int main()
 {
 	ASSERT(1, ({ struct {int a; int b;} x; x.a=1; x.b=2; x.a; }));
@@ -54,6 +63,39 @@ int main()
 	ASSERT(1, ({ struct {int a;} x={1}, y={2}; (1?x:y).a; }));
 	ASSERT(2, ({ struct {int a;} x={1}, y={2}; (0?x:y).a; }));
 
+	ASSERT(7, ({ struct {char a[7];} x={{1,2,3,4,5,6,7}}, y; y=x; y.a[6]; }));
+	ASSERT(6, ({ struct {short a; char b[3];} x={1,{4,5,6}}, y; y=x; y.b[2]; }));
+	ASSERT(3, ({ struct __attribute__((packed)) {char a; int b; short c;} x={1,2,3}, y; y=x; y.c; }));
+	ASSERT(9, ({ struct {long a[3]; int b;} x={{1,2,3},9}, y; y=x; y.b; }));
+	ASSERT(40, ({ struct {long a[20];} x, y; for (int i=0; i<20; i++) x.a[i]=i*2; y=x; y.a[19]+y.a[1]; }));
+	ASSERT(103, ({ struct {char a[99];} x={{1}}, y; x.a[98]=100; int k=3, *p=&k; *p + (y=x).a[98]; }));
+
+	ASSERT(5, ({ struct {char a[3000]; int b; double c;} x; x.b=5; x.c=2.5; x.b; }));
+	ASSERT(10, ({ struct {char a[3000]; int b; double c;} x; x.b=5; x.c=2.5; (int)(x.c*4); }));
+	ASSERT(7, ({ struct {int a; long b[4];} x, *p=&x; p->b[3]=7; p->b[2]=1; p->b[3]; }));
+	ASSERT(9, ({ struct {int a; long b[600];} x, *p=&x; p->b[599]=9; p->b[0]=2; p->b[599]; }));
+	ASSERT(11, ({ struct {short a; struct {char c; int d;} in[2];} x; x.in[1].d=11; x.in[0].d=3; x.in[1].d; }));
+	ASSERT(12, ({ int a[1000]; a[999]=12; a[511]=6; a[998]=1; a[999]; }));
+	ASSERT(6, ({ int a[1000]; int *p=a+500; p[11]=6; p[-1]=3; a[511]; }));
+	ASSERT(4, ({ long a[4]={1,2,3,4}; long *p=a+3; *(p-2)=p[0]; a[1]; }));
+
+	ASSERT(3, ({ struct vn { volatile struct vn *next; int v; } a, b; a.next=&b; b.v=3; a.next->v; }));
+	ASSERT(16, ({ struct vn { volatile struct vn *next; int v; } a; sizeof(*a.next); }));
+
+	ASSERT(10, ({ SraInt s=sra_int(1); s.c+s.s+s.i+s.l; }));
+	ASSERT(-4, ({ SraInt s=sra_int(-2); s.s; }));
+	ASSERT(-8, ({ SraInt s=sra_int(-2); s.l; }));
+	ASSERT(16, ({ SraFloat s=sra_float(2.5, 4.0); (int)(s.f*2+s.i+s.d); }));
+	ASSERT(3, ({ SraFloat s=sra_float(1.5, 0.5); s.f+=s.d; s.d++; (int)(s.f+s.d); }));
+	ASSERT(45, ({ SraInt s={0}; for (int i=0; i<10; i++) { s.i+=i; s.c++; } s.i+s.c-10; }));
+	ASSERT(1, ({ int a[4]={1,2,3,4}; SraPtr s={a, 0}; s.p++; s.n=*s.p++; s.n+(s.p-a)-3; }));
+	ASSERT(28, ({ SraInt s=sra_int(2); s.i+=1; s.l+=s.i; sra_sum(s); }));
+	ASSERT(9, ({ SraInt s=sra_int(3), t; t=s; t.i+s.c-3; }));
+	ASSERT(12, ({ SraInt s; s.i=1; int k=(s=sra_int(4)).i; k+s.i-12; }));
+	ASSERT(5, ({ SraInt s; s.i=0; SraInt t=({ s=sra_int(5); }); t.c+s.c-5; }));
+	ASSERT(6, sra_twice(1).i);
+	ASSERT(10, sra_twice(1).l);
+
 	pass();
 	return 0;
 }
@@ -2,6 +2,8 @@
 
 int g1, g2[4];
 static int g3 = 3;
+static double g4;
+static long g5[3];
 
 int main()
 {
@@ -68,6 +70,15 @@ int main()
 
 	ASSERT(3, g3);
 
+	ASSERT(0, ({ char x=0; for (int i=0; i<256; i++) x++; x; }));
+	ASSERT(44, ({ unsigned char x=200; x+=100; x; }));
+	ASSERT(-56, ({ signed char x=100; x*=2; x+=0; x; }));
+	ASSERT(10, ({ volatile int x=0; for (int i=0; i<10; i++) x++; x; }));
+	ASSERT(7, ({ int x=3; int *p=&x; *p+=4; x; }));
+	ASSERT(4, ({ g3++; g3; }));
+	ASSERT(5, ({ g4 = 2.5; g4 += g4; (int)g4; }));
+	ASSERT(9, ({ g5[0] = 2; g5[2] = 7; g5[0] + g5[2]; }));
+
 	pass();
 	return 0;
 }
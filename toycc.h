@@ -30,6 +30,7 @@ const char *get_base_file(void);
 const struct StringArray *get_include_paths(void);
 bool get_opt_fcommon(void);
 bool get_opt_fpic(void);
+int get_opt_O(void);
 
 // tokenize.c
 enum TokenKind {
@@ -160,6 +161,9 @@ enum NodeKind {
 	ND_LT,		// <
 	ND_LE,		// <=
 	ND_ASSIGN,	// =
+	ND_ASSIGN_OP,	// op=, prefix ++ and --
+	ND_POST_INC,	// postfix ++ and --
+	ND_LHS_VAL,	// value the lhs of ND_ASSIGN_OP had before
 	ND_COND,	// ?:
 	ND_COMMA,	// ,
 	ND_MEMBER,	// . (struct member access)
@@ -225,18 +229,20 @@ struct Node {
 	struct Type *func_ty;
 	struct Node *args;
 	bool pass_by_stack;
+	const char *arg_reg;	// evaluated straight into this register
 	struct Obj *ret_buffer;
 
 	// Goto or labeled statement, or labels-as-values
 	const char *label;
 	const char *unique_label;
 	struct Node *goto_next;
+	bool is_label_val;	// the label's address is taken
 
 	// Switch
 	struct Node *case_next;
 	struct Node *default_case;
 
-	// Case
+	// Case, or the bytes [begin, end) of var ND_MEMZERO clears
 	long begin;
 	long end;
 
@@ -255,7 +261,7 @@ struct Node {
 	// variable
 	struct Obj *var;
 
-	// numeric literal
+	// numeric literal, or what ND_POST_INC adds
 	int64_t val;
 	long double fval;
 };
@@ -282,12 +288,17 @@ struct Obj {
 
 	// local variable
 	int offset;		// Offset from fp
+	int reg;		// Kept in tmpreg[reg - 1] instead of memory if nonzero
+	int nr_uses;		// Uses weighted by loop nesting
+	bool is_addr_taken;
+	struct Obj **parts;	// scalars a small struct is split into
 
 	// global variable or function
 	bool is_function;
 	// function definition
 	bool is_definition;
 	bool is_static;
+	bool is_live;		// reachable from a non-static one, emitted
 
 	// global variable
 	bool is_tentative;
@@ -297,26 +308,122 @@ struct Obj {
 
 	// function
 	bool is_inline;
+	bool is_always_inline;	// __attribute__((always_inline))
+	bool is_noinline;	// __attribute__((noinline))
 	struct Obj *params;
 	struct Node *body;
 	struct Obj *locals;
 	struct Obj *va_area;
 	struct Obj *alloca_bottom;
 	int stack_size;
-
-	// for static inline function
-	bool is_live;		// referenced function
-	bool is_root;		// !(static && inline)
-	struct StringArray refs;// referencing functions
 };
 
 struct Node *new_cast(struct Node *expr, struct Type *ty);
 int64_t const_expr(struct Token **rest, struct Token *tok);
 struct Obj *parser(struct Token *tok);
+void fold_constants(struct Obj *prog);
+void inline_functions(struct Obj *prog);
+void optimize_loops(struct Obj *prog);
+void split_aggregates(struct Obj *prog);
+void remove_dead_globals(struct Obj *prog);
 
 // codegen.c
 void codegen(struct Obj *prog, FILE *out);
 int align_to(int n, int align);
+void promote_lvars(struct Obj *prog);
+
+// ir.c
+enum InsnKind {
+	IR_INSN,	// machine instruction
+	IR_LABEL,	// label definition
+	IR_DIRECTIVE,	// assembler directive or comment
+	IR_ASM,		// inline assembly, opaque to passes
+};
+
+#define IR_MAX_OPNDS 4
+#define IR_NR_REGS 64
+#define IR_REG(n) ((uint64_t)1 << (n))
+#define IR_RA 1
+#define IR_SP 2
+#define IR_FP 8
+// never considered dead: zero, ra, sp, gp, tp and fp
+#define IR_FIXED_REGS (IR_REG(0) | IR_REG(1) | IR_REG(IR_SP) | \
+		       IR_REG(3) | IR_REG(4) | IR_REG(8))
+// s0-s11 and fs0-fs11
+#define IR_CALLEE_SAVED_REGS (0x3UL << 8 | 0x3ffUL << 18 | \
+			      0x3UL << 40 | 0x3ffUL << 50)
+
+struct Insn {
+	enum InsnKind kind;
+	struct Insn *prev;
+	struct Insn *next;
+	const char *op;		// mnemonic, label name or the whole line
+	const char *opnds[IR_MAX_OPNDS];
+	int nr_opnds;
+	bool is_addr_taken;	// label reachable by indirect jumps
+	bool is_volatile;	// load of a volatile object
+};
+
+struct BasicBlock {
+	struct BasicBlock *next;
+	struct Insn *head;
+	struct Insn *tail;
+	const char *label;	// NULL if only entered by falling through
+	struct BasicBlock *succ[2];
+	int nr_preds;
+	bool falls_through;
+	bool is_reachable;
+
+	// liveness, sets of registers
+	uint64_t gen;
+	uint64_t kill;
+	uint64_t live_in;
+	uint64_t live_out;
+};
+
+struct IRFunc {
+	struct Obj *fn;
+	struct Insn *head;
+	struct Insn *tail;
+	struct BasicBlock *blocks;	// built by ir_build_cfg()
+};
+
+struct IRFunc *new_ir_func(struct Obj *fn);
+void ir_append(struct IRFunc *ir, const char *text);
+void ir_append_asm(struct IRFunc *ir, const char *str);
+void ir_concat(struct IRFunc *ir, struct IRFunc *other);
+void ir_insert(struct IRFunc *ir, struct Insn *pos, struct IRFunc *other);
+void ir_delete(struct IRFunc *ir, struct Insn *insn);
+bool ir_is(struct Insn *insn, const char *op);
+bool ir_is_cond_branch(struct Insn *insn);
+bool ir_is_jump(struct Insn *insn);
+const char *ir_branch_target(struct Insn *insn);
+struct Insn *ir_next(struct Insn *insn);
+struct Insn *ir_prev(struct Insn *insn);
+void ir_build_cfg(struct IRFunc *ir);
+int ir_reg(const char *name);
+const char *ir_reg_name(int reg);
+bool ir_is_load(struct Insn *insn);
+bool ir_is_store(struct Insn *insn);
+bool ir_is_call(struct Insn *insn);
+bool ir_has_side_effects(struct Insn *insn);
+uint64_t ir_uses(struct Insn *insn);
+uint64_t ir_defs(struct Insn *insn);
+void ir_liveness(struct IRFunc *ir);
+uint64_t ir_live_before(struct Insn *insn, uint64_t live_after);
+bool ir_is_dead(struct Insn *insn, uint64_t live_after);
+uint64_t ir_touched_regs(struct IRFunc *ir);
+void ir_emit(struct IRFunc *ir, FILE *out);
+
+// peephole.c
+void peephole(struct IRFunc *ir);
+
+// cse.c
+void eliminate_common_subexprs(struct IRFunc *ir);
+
+// pass.c
+void optimize(struct Obj *prog);
+void optimize_ir(struct IRFunc *ir);
 
 // utils.c
 bool equal(struct Token *tok, const char *op);
@@ -329,6 +436,8 @@ void __attribute__((noreturn))
 error_tok(struct Token *tok, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 void warn_tok(struct Token *tok, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 int llog2(int num);
+int ctz64(uint64_t val);
+int bit_width(uint64_t val);
 
 // unicode.c
 int encode_utf8(char *buf, uint32_t c);
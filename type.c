@@ -247,6 +247,19 @@ struct Type *copy_type(struct Type *ty)
 	return ret;
 }
 
+// The type of a member or an element of a volatile object.
+static struct Type *volatile_type(struct Type *ty)
+{
+	if (ty->is_volatile)
+		return ty;
+
+	struct Type *ret = copy_type(ty);
+	ret->is_volatile = true;
+	if (ty->kind == TY_ARRAY)
+		ret->base = volatile_type(ty->base);
+	return ret;
+}
+
 struct Type *pointer_to(struct Type *base)
 {
 	struct Type *ty = new_type(TY_PTR, sizeof(long), sizeof(long));
@@ -387,6 +400,17 @@ void add_type(struct Node *node)
 		node->ty = node->lhs->ty;
 		break;
 
+	case ND_ASSIGN_OP:
+		if (node->lhs->ty->kind == TY_ARRAY)
+			error_tok(node->lhs->tok, "not an lvalue");
+		node->rhs = new_cast(node->rhs, node->lhs->ty);
+		node->ty = node->lhs->ty;
+		break;
+
+	case ND_POST_INC:
+		node->ty = node->lhs->ty;
+		break;
+
 	case ND_EQ:
 	case ND_NE:
 	case ND_LT:
@@ -431,6 +455,8 @@ void add_type(struct Node *node)
 
 	case ND_MEMBER:
 		node->ty = node->member->ty;
+		if (node->lhs->ty->is_volatile)
+			node->ty = volatile_type(node->ty);
 		break;
 
 	case ND_ADDR: {
@@ -7,6 +7,7 @@ struct Type {
 	int align;		// alignment
 	bool is_unsigned;	// unsigned or signed
 	bool is_atomic;		// true if _Atomic
+	bool is_volatile;	// true if volatile
 	struct Type *origin;	// for type compatibility check
 
 	// pointer-to or array-of type.
@@ -89,6 +89,28 @@ int llog2(int num)
 	return ret;
 }
 
+// The number of trailing zero bits of a nonzero `val`.
+int ctz64(uint64_t val)
+{
+	int n = 0;
+
+	while (!(val & 1)) {
+		val >>= 1;
+		n++;
+	}
+	return n;
+}
+
+// The number of bits needed to represent `val`, 0 for 0.
+int bit_width(uint64_t val)
+{
+	int n = 0;
+
+	for (; val; val >>= 1)
+		n++;
+	return n;
+}
+
 struct Token *skip(struct Token *tok, const char *s)
 {
 	if (!equal(tok, s))